@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
+#include <new>
 #include <type_traits>
 #include <utility>
 #include <memory>
@@ -9,34 +11,80 @@ inline constexpr struct multishot_call_t {
     explicit multishot_call_t() = default;
 } multishot_call;
 
+// 小对象优化：捕获不超过 _inline_size 字节（例如 this + shared_ptr + 一个
+// bytes_view）的函数对象直接存放在 callback 内部，只有大的才分配堆内存
 template <class... Args>
 struct callback {
-    struct _callback_base {
-        virtual void _call(Args... args) = 0;
-        virtual ~_callback_base() = default;
+    static constexpr size_t _inline_size = 6 * sizeof(void *);
+
+    struct _vtable {
+        void (*m_call)(void *storage, Args... args);
+        // 从 src 移动构造到 dst，并析构 src
+        void (*m_relocate)(void *dst, void *src) noexcept;
+        void (*m_destroy)(void *storage) noexcept;
+    };
+
+    template <class F>
+    static constexpr bool _is_inline =
+        sizeof(F) <= _inline_size &&
+        alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible_v<F>;
+
+    template <class F>
+    struct _inline_ops {
+        static void _call(void *storage, Args... args) {
+            (*static_cast<F *>(storage))(std::forward<Args>(args)...);
+        }
+
+        static void _relocate(void *dst, void *src) noexcept {
+            ::new (dst) F(std::move(*static_cast<F *>(src)));
+            static_cast<F *>(src)->~F();
+        }
+
+        static void _destroy(void *storage) noexcept {
+            static_cast<F *>(storage)->~F();
+        }
+
+        static constexpr _vtable table = {_call, _relocate, _destroy};
     };
 
     template <class F>
-    struct _callback_impl final : _callback_base {
-        F m_func;
+    struct _heap_ops {
+        static F *&_ptr(void *storage) noexcept {
+            return *static_cast<F **>(storage);
+        }
+
+        static void _call(void *storage, Args... args) {
+            (*_ptr(storage))(std::forward<Args>(args)...);
+        }
 
-        template <class... Ts,
-                  class = std::enable_if_t<std::is_constructible_v<F, Ts...>>>
-        _callback_impl(Ts &&...ts) : m_func(std::forward<Ts>(ts)...) {}
+        static void _relocate(void *dst, void *src) noexcept {
+            ::new (dst) F *(_ptr(src));
+        }
 
-        void _call(Args... args) override {
-            m_func(std::forward<Args>(args)...);
+        static void _destroy(void *storage) noexcept {
+            delete _ptr(storage);
         }
+
+        static constexpr _vtable table = {_call, _relocate, _destroy};
     };
 
-    std::unique_ptr<_callback_base> m_base;
+    alignas(std::max_align_t) mutable unsigned char m_storage[_inline_size];
+    _vtable const *m_vtable = nullptr;
 
     template <class F, class = std::enable_if_t<
                            std::is_invocable_v<F, Args...> &&
                            !std::is_same_v<std::decay_t<F>, callback>>>
-    callback(F &&f)
-        : m_base(std::make_unique<_callback_impl<std::decay_t<F>>>(
-              std::forward<F>(f))) {}
+    callback(F &&f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (_is_inline<Fn>) {
+            ::new (static_cast<void *>(m_storage)) Fn(std::forward<F>(f));
+            m_vtable = &_inline_ops<Fn>::table;
+        } else {
+            ::new (static_cast<void *>(m_storage)) Fn *(new Fn(std::forward<F>(f)));
+            m_vtable = &_heap_ops<Fn>::table;
+        }
+    }
 
     callback() = default;
 
@@ -44,36 +92,48 @@ struct callback {
 
     callback(callback const &) = delete;
     callback &operator=(callback const &) = delete;
-    callback(callback &&) = default;
-    callback &operator=(callback &&) = default;
 
-    void operator()(Args... args) {
-        assert(m_base);
-        m_base->_call(std::forward<Args>(args)...);
-        m_base = nullptr; // 所有回调，只能调用一次
+    callback(callback &&that) noexcept : m_vtable(that.m_vtable) {
+        if (m_vtable) {
+            m_vtable->m_relocate(m_storage, that.m_storage);
+            that.m_vtable = nullptr;
+        }
     }
 
-    void operator()(multishot_call_t, Args... args) const {
-        assert(m_base);
-        m_base->_call(std::forward<Args>(args)...);
+    callback &operator=(callback &&that) noexcept {
+        if (this != &that) {
+            reset();
+            if (that.m_vtable) {
+                that.m_vtable->m_relocate(m_storage, that.m_storage);
+                m_vtable = std::exchange(that.m_vtable, nullptr);
+            }
+        }
+        return *this;
     }
 
-    void *get_address() const noexcept {
-        return static_cast<void *>(m_base.get());
+    ~callback() {
+        reset();
     }
 
-    void *leak_address() noexcept {
-        return static_cast<void *>(m_base.release());
+    void reset() noexcept {
+        if (m_vtable) {
+            std::exchange(m_vtable, nullptr)->m_destroy(m_storage);
+        }
     }
 
-    static callback from_address(void *addr) noexcept {
-        callback cb;
-        cb.m_base = std::unique_ptr<_callback_base>(
-            static_cast<_callback_base *>(addr));
-        return cb;
+    void operator()(Args... args) {
+        assert(m_vtable);
+        // 所有回调，只能调用一次：先移出到局部变量，回调里重新赋值 *this 也安全
+        callback self = std::move(*this);
+        self.m_vtable->m_call(self.m_storage, std::forward<Args>(args)...);
+    }
+
+    void operator()(multishot_call_t, Args... args) const {
+        assert(m_vtable);
+        m_vtable->m_call(m_storage, std::forward<Args>(args)...);
     }
 
     explicit operator bool() const noexcept {
-        return m_base != nullptr;
+        return m_vtable != nullptr;
     }
-};
\ No newline at end of file
+};
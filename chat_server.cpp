@@ -26,40 +26,69 @@ struct RecvParams {
 std::vector<Message> messages;
 stop_source recv_timeout_stop = stop_source::make();
 
+// 一次发送的消息很多时分块发送：每批编码一部分，发送完再编码下一批，
+// 第一批很快就能发出去，也不用先在内存里拼出整个 JSON 数组
+constexpr size_t messages_per_chunk = 256;
+
+void do_write_messages(http_server::http_request &request, size_t first,
+                       size_t i, size_t last) {
+    size_t next = std::min(i + messages_per_chunk, last);
+    std::string chunk = i == first ? "[" : "";
+    for (size_t j = i; j < next; ++j) {
+        if (j != first) {
+            chunk += ',';
+        }
+        chunk += reflect::json_encode(messages[j]);
+    }
+    if (next == last) {
+        chunk += ']';
+        return request.write_chunk(std::move(chunk), [&request] {
+            request.end_chunked_response();
+        });
+    }
+    request.write_chunk(std::move(chunk), [&request, first, next, last] {
+        do_write_messages(request, first, next, last);
+    });
+}
+
+// 发送 first 之后的所有消息；first 来自客户端，超出已有消息时发送空数组
+void write_messages(http_server::http_request &request, size_t first) {
+    size_t last = messages.size();
+    first = std::min(first, last);
+    if (last - first <= messages_per_chunk) {
+        std::vector<Message> submessages(messages.begin() + first,
+                                         messages.begin() + last);
+        return request.write_response(200, reflect::json_encode(submessages));
+    }
+    request.begin_chunked_response(200, [&request, first, last] {
+        do_write_messages(request, first, first, last);
+    });
+}
+
 void server() {
     io_context ctx;
     chdir("../static");
     messages.push_back({"系统", "你好，欢迎来到在线聊天室"});
     auto server = http_server::make();
     server->get_router().route("/", [](http_server::http_request &request) {
-        std::string response = file_get_content("index.html");
-        request.write_response(200, response, "text/html");
+        request.write_static_response("index.html", "text/html");
     });
     server->get_router().route("/send", [](http_server::http_request &request) {
         // fmt::println("/send 收到了 {}", request.body);
-        messages.push_back(reflect::json_decode<Message>(request.body));
+        messages.push_back(reflect::json_decode<Message>(request.body.to_string()));
         recv_timeout_stop.request_stop();
         recv_timeout_stop = stop_source::make();
         request.write_response(200, "OK");
     });
     server->get_router().route("/recv", [](http_server::http_request &request) {
-        auto params = reflect::json_decode<RecvParams>(request.body);
+        auto params = reflect::json_decode<RecvParams>(request.body.to_string());
         if (messages.size() > params.first) {
-            std::vector<Message> submessages(messages.begin() + params.first,
-                                             messages.end());
-            std::string response = reflect::json_encode(submessages);
-            // fmt::println("/recv 立即返回 {}", response);
-            request.write_response(200, response);
+            // fmt::println("/recv 立即返回");
+            write_messages(request, params.first);
         } else {
             io_context::get().set_timeout(3s, [&request, params] {
-                std::vector<Message> submessages;
-                if (messages.size() > params.first) {
-                    submessages.assign(messages.begin() + params.first,
-                                       messages.end());
-                }
-                std::string response = reflect::json_encode(submessages);
-                // fmt::println("/recv 延迟返回 {}", response);
-                request.write_response(200, response);
+                // fmt::println("/recv 延迟返回");
+                write_messages(request, params.first);
             }, recv_timeout_stop);
         }
     });
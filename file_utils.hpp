@@ -1,9 +1,16 @@
 #pragma once
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
 #include <fstream>
 #include <string>
 #include <string_view>
 #include <algorithm>
+#include "callback.hpp"
+#include "expected.hpp"
+#include "worker_pool.hpp"
 
 inline std::string file_get_content(std::string const &path) {
     std::ifstream file(path);
@@ -20,4 +27,91 @@ inline void file_put_content(std::string const &path, std::string_view content)
         throw std::system_error(errno, std::generic_category());
     }
     std::copy(content.begin(), content.end(), std::ostreambuf_iterator<char>(file));
-}
\ No newline at end of file
+}
+
+// 读取整个文件，出错时返回 -errno，不抛异常（在工作线程里执行）
+inline expected<size_t> _file_read_all(std::string const &path, std::string &content) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -errno;
+    }
+    file_descriptor file(fd);
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -errno;
+    }
+    content.resize(st.st_size);
+    size_t n = 0;
+    while (true) {
+        if (n == content.size()) {
+            // 文件可能在 fstat 之后变长了，继续读到末尾
+            content.resize(std::max<size_t>(content.size() * 2, 4096));
+        }
+        ssize_t ret = read(fd, content.data() + n, content.size() - n);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (ret == 0) {
+            break;
+        }
+        n += ret;
+    }
+    content.resize(n);
+    return n;
+}
+
+// 写完整个 content 才返回（普通文件一般一次就能写完）
+inline expected<size_t> _fd_write_all(int fd, std::string_view content) {
+    size_t n = 0;
+    while (n != content.size()) {
+        ssize_t ret = write(fd, content.data() + n, content.size() - n);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        n += ret;
+    }
+    return n;
+}
+
+inline expected<size_t> _file_write_all(std::string const &path, std::string_view content) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -errno;
+    }
+    file_descriptor file(fd);
+    return _fd_write_all(fd, content);
+}
+
+// 非阻塞版本：读写在阻塞 I/O 线程池里进行，完成后回到当前 io_context 调用 cb，
+// 路由回调里用这两个，慢速磁盘不会卡住同一个循环上的其他连接
+inline void async_file_get_content(std::string path,
+                                   callback<expected<size_t>, std::string> cb) {
+    struct result {
+        expected<size_t> m_ret;
+        std::string m_content;
+    };
+    worker_pool::blocking_io().async_run(
+        [path = std::move(path)] {
+            result r;
+            r.m_ret = _file_read_all(path, r.m_content);
+            return r;
+        },
+        [cb = std::move(cb)](result r) mutable {
+            cb(r.m_ret, std::move(r.m_content));
+        });
+}
+
+inline void async_file_put_content(std::string path, std::string content,
+                                   callback<expected<size_t>> cb) {
+    worker_pool::blocking_io().async_run(
+        [path = std::move(path), content = std::move(content)] {
+            return _file_write_all(path, content);
+        },
+        std::move(cb));
+}
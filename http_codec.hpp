@@ -1,7 +1,10 @@
 #pragma once
 
+#include <charconv>
 #include "bytes_buffer.hpp"
-#include "string_map.hpp"
+#include "iobuf.hpp"
+#include "http_header_map.hpp"
+#include "http_scan.hpp"
 #include "enum_magic.hpp"
 
 /*
@@ -18,39 +21,38 @@ enum POST_TYPE {
 };
 
 struct post_image_process {
-    static POST_TYPE judgePostType(std::string contype) {
+    static POST_TYPE judgePostType(std::string_view contype) {
         if (contype.find("multipart/form-data") != std::string::npos) {
             return POST_TYPE::image;
         }
         return POST_TYPE::text;
     }
-
-    static std::string extraMulti(std::string& con) {
-        auto pos = con.find("\r\n\r\n", 0, 4);
-        if (pos == std::string::npos) {
-            throw;
-        }
-        pos += 4;
-        auto pos2 = con.find("\r\n----", pos, 6);
-        if (pos == std::string::npos) {
-            throw;
-        }
-        return con.substr(pos, pos2 - pos);
-    }
+    // 正文的解析见 multipart_parser.hpp
 };
 
+// 解析结果都是指向 m_header 的 string_view，头部只在 m_header 里存一份，
+// 直到 reset_state 之前都有效；m_header 的容量随连接复用，
+// 解析一个普通的 GET 请求不需要分配内存
 struct http11_header_parser {
-    bytes_buffer m_header;    // "GET / HTTP/1.1\nHost: 142857.red\r\nAccept:
+    bytes_buffer m_header;    // "GET / HTTP/1.1\r\nHost: 142857.red\r\nAccept:
                               // */*\r\nConnection: close"
-    std::string m_headline;   // "GET / HTTP/1.1"
-    string_map m_header_keys; // {"Host": "142857.red", "Accept": "*/*",
-                              // "Connection: close"}
-    std::string m_body; // 不小心超量读取的正文（如果有的话）
+    std::string_view m_headline; // "GET / HTTP/1.1"
+    // 首行只在头部结束时切分一次："GET"、"/"、"HTTP/1.1"
+    // 响应则是 "HTTP/1.1"、"200"、"OK"
+    std::string_view m_headline_parts[3];
+    http_header_map m_header_keys; // {"Host": "142857.red", "Accept": "*/*",
+                                   // "Connection": "close"}
+    http_header_scanner m_scanner;
+    iobuf m_body; // 正文，由 _http_base_parser 按 Content-length 放入
     bool m_header_finished = false;
 
     void reset_state() {
         m_header.clear();
-        m_headline.clear();
+        m_scanner.reset_state();
+        m_headline = {};
+        for (auto &part: m_headline_parts) {
+            part = {};
+        }
         m_header_keys.clear();
         m_body.clear();
         m_header_finished = 0;
@@ -60,69 +62,75 @@ struct http11_header_parser {
         return m_header_finished; // 如果正文都结束了，就不再需要更多数据
     }
 
+    void _split_headline() {
+        std::string_view line = m_headline;
+        size_t space1 = line.find(' ');
+        if (space1 == std::string_view::npos) {
+            return;
+        }
+        size_t space2 = line.find(' ', space1 + 1);
+        if (space2 == std::string_view::npos) {
+            return;
+        }
+        m_headline_parts[0] = line.substr(0, space1);
+        m_headline_parts[1] = line.substr(space1 + 1, space2 - (space1 + 1));
+        m_headline_parts[2] = line.substr(space2 + 1);
+    }
+
+    // 行和冒号的位置在 push_chunk 时已经由 m_scanner 找好，这里只是切分
     void _extract_headers() {
-        std::string_view header = m_header;
-        size_t pos = header.find("\r\n", 0, 2);
-        m_headline = std::string(header.substr(0, pos));
-        while (pos != std::string::npos) {
-            // 跳过 "\r\n"
-            pos += 2;
-            // 从当前位置开始找，先找到下一行位置（可能为 npos）
-            size_t next_pos = header.find("\r\n", pos, 2);
-            size_t line_len = std::string::npos;
-            if (next_pos != std::string::npos) {
-                // 如果下一行还不是结束，那么 line_len
-                // 设为本行开始到下一行之间的距离
-                line_len = next_pos - pos;
+        char const *data = m_header.data();
+        auto const &lines = m_scanner.m_lines;
+        m_headline = std::string_view(data + lines[0].m_begin,
+                                      lines[0].m_end - lines[0].m_begin);
+        _split_headline();
+        for (size_t i = 1; i < lines.size(); ++i) {
+            auto const &line = lines[i];
+            if (line.m_colon == http_header_scanner::npos) {
+                continue;
             }
-            // 就能切下本行
-            std::string_view line = header.substr(pos, line_len);
-            size_t colon = line.find(": ", 0, 2);
-            if (colon != std::string::npos) {
-                // 每一行都是 "键: 值"
-                std::string key = std::string(line.substr(0, colon));
-                std::string_view value = line.substr(colon + 2);
-                // 键统一转成小写，实现大小写不敏感的判断
-                for (char &c: key) {
-                    if ('A' <= c && c <= 'Z') {
-                        c += 'a' - 'A';
-                    }
-                }
-                // 古代 C++ 过时的写法：m_header_keys[key] = value;
-                // 现代 C++17 的高效写法：
-                m_header_keys.insert_or_assign(std::move(key), value);
+            // 每一行都是 "键: 值"，冒号后面的空白可有可无
+            std::string_view key(data + line.m_begin, line.m_colon - line.m_begin);
+            std::string_view value(data + line.m_colon + 1,
+                                   line.m_end - (line.m_colon + 1));
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+                value.remove_prefix(1);
             }
-            pos = next_pos;
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+                value.remove_suffix(1);
+            }
+            // 不复制、不转小写，查找时再大小写不敏感地比较
+            m_header_keys.push_back(key, value);
         }
     }
 
-    void push_chunk(bytes_const_view chunk) {
+    // 返回 chunk 中属于头部的字节数（包括结尾的空行）；头部没有结束时就是
+    // chunk.size()，否则剩下的是正文或者下一个请求，由调用者处理
+    size_t push_chunk(bytes_const_view chunk) {
         assert(!m_header_finished);
         size_t old_size = m_header.size();
         m_header.append(chunk);
-        std::string_view header = m_header;
-        // 如果还在解析头部的话，尝试判断头部是否结束
-        if (old_size < 4) {
-            old_size = 4;
-        }
-        old_size -= 4;
-        size_t header_len = header.find("\r\n\r\n", old_size, 4);
-        if (header_len != std::string::npos) {
-            // 头部已经结束
-            m_header_finished = true;
-            // 把不小心多读取的正文留下
-            m_body = header.substr(header_len + 4);
-            m_header.resize(header_len);
-            // 开始分析头部，尝试提取 Content-length 字段
-            _extract_headers();
+        // 只扫描新追加的字节，上一块末尾的状态保存在 m_scanner 里
+        if (!m_scanner.scan(m_header.data(), m_header.size())) {
+            return chunk.size();
         }
+        // 头部已经结束
+        m_header_finished = true;
+        m_header.resize(m_scanner.m_header_end);
+        // 开始分析头部，尝试提取 Content-length 字段
+        _extract_headers();
+        return m_scanner.m_body_begin - old_size;
     }
 
-    std::string &headline() {
+    std::string_view headline() const noexcept {
         return m_headline;
     }
 
-    string_map &headers() {
+    std::string_view headline_part(size_t i) const noexcept {
+        return m_headline_parts[i];
+    }
+
+    http_header_map &headers() {
         return m_header_keys;
     }
 
@@ -130,7 +138,7 @@ struct http11_header_parser {
         return m_header;
     }
 
-    std::string &extra_body() {
+    iobuf &extra_body() {
         return m_body;
     }
 };
@@ -141,71 +149,94 @@ struct _http_base_parser {
     size_t m_content_length = 0;
     size_t body_accumulated_size = 0;
     bool m_body_finished = false;
+    bool m_bad_content_length = false; // Content-length 不是合法的非负整数
+
+    // 分块编码（Transfer-Encoding: chunked）的正文：边收边解码，
+    // body() 里只有解码后的数据，长度行、块后的 "\r\n"、尾部字段都丢掉
+    enum _chunk_state {
+        _chunk_size,     // 在读 "长度[;扩展]\r\n"
+        _chunk_data,     // 还有 m_chunk_remaining 字节数据
+        _chunk_data_end, // 数据后面的 "\r\n"
+        _chunk_trailer,  // 长度为 0 的块之后的尾部字段，直到空行
+    };
+
+    bool m_chunked = false;
+    bool m_bad_chunked = false; // 分块格式错误，或者不支持的 Transfer-Encoding
+    _chunk_state m_chunk_state = _chunk_size;
+    size_t m_chunk_remaining = 0;
+    std::string m_chunk_line; // 还没读完的一行，容量随连接复用
 
     void reset_state() {
         m_header_parser.reset_state();
         m_content_length = 0;
         body_accumulated_size = 0;
         m_body_finished = false;
+        m_bad_content_length = false;
+        m_chunked = false;
+        m_bad_chunked = false;
+        m_chunk_state = _chunk_size;
+        m_chunk_remaining = 0;
+        m_chunk_line.clear();
     }
 
     [[nodiscard]] bool header_finished() {
         return m_header_parser.header_finished();
     }
 
-    [[nodiscard]] bool request_finished() {
+    [[nodiscard]] bool request_finished() const noexcept {
         return m_body_finished;
     }
 
-    std::string &headers_raw() {
+    // 头部结束后才有意义；格式不对时为 0，并且 bad_content_length() 为 true
+    size_t content_length() const noexcept {
+        return m_content_length;
+    }
+
+    [[nodiscard]] bool bad_content_length() const noexcept {
+        return m_bad_content_length;
+    }
+
+    // 正文是分块编码的：content_length() 为 0，正文多长要解码到最后才知道
+    [[nodiscard]] bool chunked() const noexcept {
+        return m_chunked;
+    }
+
+    [[nodiscard]] bool bad_chunked() const noexcept {
+        return m_bad_chunked;
+    }
+
+    // 到目前为止收到的正文长度（分块编码时是解码后的长度），
+    // 正文被 body() 移走后也继续累计
+    size_t body_size() const noexcept {
+        return body_accumulated_size;
+    }
+
+    bytes_buffer &headers_raw() {
         return m_header_parser.headers_raw();
     }
 
-    std::string &headline() {
+    std::string_view headline() const noexcept {
         return m_header_parser.headline();
     }
 
-    string_map &headers() {
+    http_header_map &headers() {
         return m_header_parser.headers();
     }
 
-    std::string _headline_first() {
+    std::string_view _headline_first() const noexcept {
         // "GET / HTTP/1.1" request
         // "HTTP/1.1 200 OK" response
-        auto &line = headline();
-        size_t space = line.find(' ');
-        if (space == std::string::npos) {
-            return "";
-        }
-        return line.substr(0, space);
+        return m_header_parser.headline_part(0);
     }
 
-    std::string _headline_second() {
+    std::string_view _headline_second() const noexcept {
         // "GET / HTTP/1.1"
-        auto &line = headline();
-        size_t space1 = line.find(' ');
-        if (space1 == std::string::npos) {
-            return "";
-        }
-        size_t space2 = line.find(' ', space1 + 1);
-        if (space2 == std::string::npos) {
-            return "";
-        }
-        return line.substr(space1 + 1, space2 - (space1 + 1));
+        return m_header_parser.headline_part(1);
     }
 
-    std::string _headline_third() {
+    std::string_view _headline_third() const noexcept {
         // "GET / HTTP/1.1"
-        auto &line = headline();
-        size_t space1 = line.find(' ');
-        if (space1 == std::string::npos) {
-            return "";
-        }
-        size_t space2 = line.find(' ', space1 + 1);
-        if (space2 == std::string::npos) {
-            return "";
-        }
-        return line.substr(space2);
+        return m_header_parser.headline_part(2);
     }
 
     /*
@@ -214,53 +245,151 @@ struct _http_base_parser {
     ** Author: wkxue
     ** Create time: 2024/07/23 21:21
     */
-    std::string _con_type() {
-        if (_headline_first() != "POST")    return "";
-        auto it = headers().find("content-type");
-        if ( it == headers().end()) {
-            return {};
-        }
-        return it->second;
+    std::string_view _con_type() {
+        if (_headline_first() != "POST")    return {};
+        return headers().get("content-type");
     }
 
-    std::string &body() {
+    // 正文按读到的块分段存放，不会因为不断增长而反复重新分配、搬移
+    iobuf &body() {
         return m_header_parser.extra_body();
     }
 
+    // 只接受十进制数字：负数、溢出、后面跟着其他字符都算格式错误，
+    // 不能像 stoi 那样截断成一个看似合法的长度
     size_t _extract_content_length() {
-        auto &headers = m_header_parser.headers();
-        auto it = headers.find("content-length");
-        if (it == headers.end()) {
+        auto *found = m_header_parser.headers().find("content-length");
+        if (!found) {
             return 0;
         }
-        try {
-            return std::stoi(it->second);
-        } catch (std::logic_error const &) {
+        std::string_view value = *found;
+        size_t length = 0;
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+        if (ec != std::errc() || end != value.data() + value.size() || value.empty()) {
+            m_bad_content_length = true;
             return 0;
         }
+        return length;
     }
 
-    void push_chunk(bytes_const_view chunk) {
-        assert(!m_body_finished);
-        if (!m_header_parser.header_finished()) {
-            m_header_parser.push_chunk(chunk);
-            if (m_header_parser.header_finished()) {
-                body_accumulated_size = body().size();
-                m_content_length = _extract_content_length();
-                if (body_accumulated_size >= m_content_length) {
-                    m_body_finished = true;
+    // Transfer-Encoding 的最后一项是 chunked 时按分块解码，这时忽略
+    // Content-length（RFC 9112 6.3）；其他的传输编码不支持
+    void _extract_transfer_encoding() {
+        std::string_view value = m_header_parser.headers().get("transfer-encoding");
+        if (value.empty()) {
+            return;
+        }
+        size_t comma = value.rfind(',');
+        std::string_view last = value.substr(comma == value.npos ? 0 : comma + 1);
+        while (!last.empty() && (last.front() == ' ' || last.front() == '\t')) {
+            last.remove_prefix(1);
+        }
+        if (!http_header_map::_iequals(last, "chunked")) {
+            m_bad_chunked = true;
+            return;
+        }
+        m_chunked = true;
+        m_bad_content_length = false;
+        m_content_length = 0;
+    }
+
+    size_t _push_chunked(bytes_const_view chunk) {
+        size_t i = 0;
+        while (i < chunk.size() && !m_body_finished && !m_bad_chunked) {
+            if (m_chunk_state == _chunk_data) {
+                size_t take = std::min(m_chunk_remaining, chunk.size() - i);
+                body().append(chunk.subspan(i, take));
+                body_accumulated_size += take;
+                m_chunk_remaining -= take;
+                i += take;
+                if (m_chunk_remaining == 0) {
+                    m_chunk_state = _chunk_data_end;
                 }
+                continue;
+            }
+            // 长度行、尾部字段都很短，逐字节凑成一行再处理
+            char c = chunk.data()[i++];
+            m_chunk_line.push_back(c);
+            if (c == '\n' && m_chunk_line.size() >= 2 &&
+                m_chunk_line[m_chunk_line.size() - 2] == '\r') {
+                m_chunk_line.resize(m_chunk_line.size() - 2);
+                _on_chunk_line();
+                m_chunk_line.clear();
+            } else if (m_chunk_line.size() > 4096 ||
+                       (m_chunk_state == _chunk_data_end && c != '\r')) {
+                m_bad_chunked = true; // 数据比长度行说的长
+            }
+        }
+        return i;
+    }
+
+    void _on_chunk_line() {
+        std::string_view line = m_chunk_line;
+        switch (m_chunk_state) {
+        case _chunk_size: {
+            // 扩展（";name=value"）没有用到，直接忽略
+            line = line.substr(0, line.find(';'));
+            while (!line.empty() && (line.back() == ' ' || line.back() == '\t')) {
+                line.remove_suffix(1);
+            }
+            size_t size = 0;
+            auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), size, 16);
+            if (ec != std::errc() || end != line.data() + line.size() || line.empty()) {
+                m_bad_chunked = true;
+                return;
             }
-        } else {
-            body().append(chunk);
-            body_accumulated_size += chunk.size();
-            if (body_accumulated_size >= m_content_length) {
+            m_chunk_remaining = size;
+            m_chunk_state = size == 0 ? _chunk_trailer : _chunk_data;
+            return;
+        }
+        case _chunk_data_end:
+            if (!line.empty()) {
+                m_bad_chunked = true;
+                return;
+            }
+            m_chunk_state = _chunk_size;
+            return;
+        case _chunk_trailer:
+            if (line.empty()) {
                 m_body_finished = true;
             }
+            return; // 尾部字段不使用
+        case _chunk_data:
+            return;
         }
     }
 
-    std::string read_some_body() {
+    // 返回用掉的字节数：请求结束之后的字节属于下一个请求（客户端用了
+    // 流水线），不会被当成正文，由调用者留着交给下一个请求
+    // 分块格式错误时停在出错的位置，bad_chunked() 为 true
+    size_t push_chunk(bytes_const_view chunk) {
+        assert(!m_body_finished);
+        size_t used = 0;
+        if (!m_header_parser.header_finished()) {
+            used = m_header_parser.push_chunk(chunk);
+            if (!m_header_parser.header_finished()) {
+                return used;
+            }
+            m_content_length = _extract_content_length();
+            _extract_transfer_encoding();
+            chunk = chunk.subspan(used);
+            if (m_bad_chunked) {
+                return used;
+            }
+        }
+        if (m_chunked) {
+            return used + _push_chunked(chunk);
+        }
+        size_t take = std::min(chunk.size(), m_content_length - body_accumulated_size);
+        body().append(chunk.subspan(0, take));
+        body_accumulated_size += take;
+        if (body_accumulated_size >= m_content_length) {
+            m_body_finished = true;
+        }
+        return used + take;
+    }
+
+    iobuf read_some_body() {
         return std::move(body());
     }
 };
@@ -284,11 +413,12 @@ struct http_request_parser : _http_base_parser<HeaderParser> {
         return parse_enum<http_method>(this->_headline_first());
     }
 
-    std::string url() {
+    // 和 headers() 一样指向头部缓冲区，reset_state 之前有效
+    std::string_view url() {
         return this->_headline_second();
     }
 
-    std::string content_type() {
+    std::string_view content_type() {
         return this->_con_type();
     }
 };
@@ -297,14 +427,58 @@ template <class HeaderParser = http11_header_parser>
 struct http_response_parser : _http_base_parser<HeaderParser> {
     int status() {
         auto s = this->_headline_second();
-        try {
-            return std::stoi(s);
-        } catch (std::logic_error const &) {
+        int status = -1;
+        auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), status);
+        if (ec != std::errc() || end != s.data() + s.size()) {
             return -1;
         }
+        return status;
     }
 };
 
+// 完整的状态行，原因短语按 RFC 9110；不认识的状态码返回空
+// switch 由编译器生成跳转表，状态行都是字面量，写出时只有一次 memcpy
+inline constexpr std::string_view http_status_line(int status) noexcept {
+    switch (status) {
+    case 100: return "HTTP/1.1 100 Continue";
+    case 101: return "HTTP/1.1 101 Switching Protocols";
+    case 200: return "HTTP/1.1 200 OK";
+    case 201: return "HTTP/1.1 201 Created";
+    case 202: return "HTTP/1.1 202 Accepted";
+    case 204: return "HTTP/1.1 204 No Content";
+    case 206: return "HTTP/1.1 206 Partial Content";
+    case 301: return "HTTP/1.1 301 Moved Permanently";
+    case 302: return "HTTP/1.1 302 Found";
+    case 303: return "HTTP/1.1 303 See Other";
+    case 304: return "HTTP/1.1 304 Not Modified";
+    case 307: return "HTTP/1.1 307 Temporary Redirect";
+    case 308: return "HTTP/1.1 308 Permanent Redirect";
+    case 400: return "HTTP/1.1 400 Bad Request";
+    case 401: return "HTTP/1.1 401 Unauthorized";
+    case 403: return "HTTP/1.1 403 Forbidden";
+    case 404: return "HTTP/1.1 404 Not Found";
+    case 405: return "HTTP/1.1 405 Method Not Allowed";
+    case 408: return "HTTP/1.1 408 Request Timeout";
+    case 409: return "HTTP/1.1 409 Conflict";
+    case 411: return "HTTP/1.1 411 Length Required";
+    case 412: return "HTTP/1.1 412 Precondition Failed";
+    case 413: return "HTTP/1.1 413 Content Too Large";
+    case 414: return "HTTP/1.1 414 URI Too Long";
+    case 415: return "HTTP/1.1 415 Unsupported Media Type";
+    case 416: return "HTTP/1.1 416 Range Not Satisfiable";
+    case 417: return "HTTP/1.1 417 Expectation Failed";
+    case 429: return "HTTP/1.1 429 Too Many Requests";
+    case 431: return "HTTP/1.1 431 Request Header Fields Too Large";
+    case 500: return "HTTP/1.1 500 Internal Server Error";
+    case 501: return "HTTP/1.1 501 Not Implemented";
+    case 502: return "HTTP/1.1 502 Bad Gateway";
+    case 503: return "HTTP/1.1 503 Service Unavailable";
+    case 504: return "HTTP/1.1 504 Gateway Timeout";
+    case 505: return "HTTP/1.1 505 HTTP Version Not Supported";
+    default: return {};
+    }
+}
+
 struct http11_header_writer {
     bytes_buffer m_buffer;
 
@@ -332,6 +506,22 @@ struct http11_header_writer {
         m_buffer.append(value);
     }
 
+    // 预先拼好的若干行，每行以 "\r\n" 开头（和 write_header 写出的一样）
+    void write_raw(std::string_view lines) {
+        m_buffer.append(lines);
+    }
+
+    // 数字直接 to_chars 到预留的位置，不经过临时的 std::string
+    void write_content_length(size_t length) {
+        constexpr std::string_view prefix = "\r\nContent-length: ";
+        size_t old_size = m_buffer.size();
+        m_buffer.resize(old_size + prefix.size() + 20);
+        char *p = m_buffer.data() + old_size;
+        p = std::copy(prefix.begin(), prefix.end(), p);
+        p = std::to_chars(p, m_buffer.end(), length).ptr;
+        m_buffer.resize(p - m_buffer.data());
+    }
+
     void end_header() {
         m_buffer.append_literial("\r\n\r\n");
     }
@@ -340,6 +530,7 @@ struct http11_header_writer {
 template <class HeaderWriter = http11_header_writer>
 struct _http_base_writer {
     HeaderWriter m_header_writer;
+    iobuf m_body; // 正文单独存放，不拷贝进头部缓冲区
 
     void _begin_header(std::string_view first, std::string_view second,
                        std::string_view third) {
@@ -348,22 +539,86 @@ struct _http_base_writer {
 
     void reset_state() {
         m_header_writer.reset_state();
+        m_body.clear();
     }
 
     bytes_buffer &buffer() {
         return m_header_writer.buffer();
     }
 
+    iobuf &body() {
+        return m_body;
+    }
+
     void write_header(std::string_view key, std::string_view value) {
         m_header_writer.write_header(key, value);
     }
 
+    void write_raw(std::string_view lines) {
+        m_header_writer.write_raw(lines);
+    }
+
+    void write_content_length(size_t length) {
+        m_header_writer.write_content_length(length);
+    }
+
     void end_header() {
         m_header_writer.end_header();
     }
 
     void write_body(std::string_view body) {
-        m_header_writer.buffer().append(body);
+        m_body.append(body);
+    }
+
+    // 接管调用者的字符串（只接受 std::string 右值），大的正文不再复制
+    template <class String, std::enable_if_t<
+                                std::is_same_v<String, std::string>, int> = 0>
+    void write_body(String &&body) {
+        m_body.append_owned(std::move(body));
+    }
+
+    void write_body(iobuf body) {
+        m_body.append(std::move(body));
+    }
+
+    // 借用调用者的内存，不复制也不接管；调用者保证发送完成前内存有效
+    void write_body_borrowed(bytes_const_view body) {
+        m_body.append_foreign(body);
+    }
+
+    // 分块编码（Transfer-Encoding: chunked）：每块前面加上十六进制的长度，
+    // 正文不用一次准备好，也就不用先算出 Content-length；最后调用 end_chunks
+    // 空的块会被跳过，长度为 0 的块表示正文结束
+    void write_chunk(std::string_view data) {
+        if (data.empty()) {
+            return;
+        }
+        _write_chunk_size(data.size());
+        m_body.append(data);
+        m_body.append(std::string_view("\r\n"));
+    }
+
+    template <class String, std::enable_if_t<
+                                std::is_same_v<String, std::string>, int> = 0>
+    void write_chunk(String &&data) {
+        if (data.empty()) {
+            return;
+        }
+        _write_chunk_size(data.size());
+        m_body.append_owned(std::move(data));
+        m_body.append(std::string_view("\r\n"));
+    }
+
+    void end_chunks() {
+        m_body.append(std::string_view("0\r\n\r\n"));
+    }
+
+    void _write_chunk_size(size_t size) {
+        char buf[sizeof(size_t) * 2 + 2];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), size, 16);
+        *end++ = '\r';
+        *end++ = '\n';
+        m_body.append(std::string_view(buf, end - buf));
     }
 };
 
@@ -377,6 +632,109 @@ struct http_request_writer : _http_base_writer<HeaderWriter> {
 template <class HeaderWriter = http11_header_writer>
 struct http_response_writer : _http_base_writer<HeaderWriter> {
     void begin_header(int status) {
-        this->_begin_header("HTTP/1.1", std::to_string(status), "OK");
+        std::string_view line = http_status_line(status);
+        if (!line.empty()) {
+            return this->m_header_writer.write_raw(line);
+        }
+        char code[16];
+        char *end = std::to_chars(code, code + sizeof(code), status).ptr;
+        this->_begin_header("HTTP/1.1", std::string_view(code, end - code), "Unknown");
+    }
+};
+// Range 请求头的解析结果
+enum class http_range_result {
+    none,          // 没有 Range，或者不支持的形式（多段等），按完整内容响应
+    satisfiable,   // 206
+    unsatisfiable, // 416
+};
+
+// 只支持单段的 "bytes=first-last"、"bytes=first-"、"bytes=-suffix"
+inline http_range_result http_parse_range(std::string_view range, size_t size,
+                                          size_t &first, size_t &length) {
+    constexpr std::string_view prefix = "bytes=";
+    if (range.substr(0, prefix.size()) != prefix) {
+        return http_range_result::none;
+    }
+    range.remove_prefix(prefix.size());
+    if (range.find(',') != std::string_view::npos) {
+        return http_range_result::none;
+    }
+    size_t dash = range.find('-');
+    if (dash == std::string_view::npos) {
+        return http_range_result::none;
+    }
+    auto parse_number = [](std::string_view s, size_t &out) {
+        if (s.empty() || s.size() > 19) {
+            return false;
+        }
+        out = 0;
+        for (char c: s) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            out = out * 10 + (c - '0');
+        }
+        return true;
+    };
+    std::string_view first_str = range.substr(0, dash);
+    std::string_view last_str = range.substr(dash + 1);
+    size_t last;
+    if (first_str.empty()) {
+        // 最后 suffix 个字节
+        size_t suffix;
+        if (!parse_number(last_str, suffix)) {
+            return http_range_result::none;
+        }
+        if (suffix == 0 || size == 0) {
+            return http_range_result::unsatisfiable;
+        }
+        first = suffix < size ? size - suffix : 0;
+        length = size - first;
+        return http_range_result::satisfiable;
+    }
+    if (!parse_number(first_str, first)) {
+        return http_range_result::none;
+    }
+    if (last_str.empty()) {
+        last = size - 1;
+    } else if (!parse_number(last_str, last) || last < first) {
+        return http_range_result::none;
+    }
+    if (first >= size) {
+        return http_range_result::unsatisfiable;
+    }
+    if (last >= size) {
+        last = size - 1;
+    }
+    length = last - first + 1;
+    return http_range_result::satisfiable;
+}
+
+// If-None-Match 的弱比较：列表中任意一个和 etag 相同（忽略 W/ 前缀）即匹配
+inline bool http_etag_list_match(std::string_view list, std::string_view etag) {
+    auto strip_weak = [](std::string_view tag) {
+        if (tag.substr(0, 2) == "W/") {
+            tag.remove_prefix(2);
+        }
+        return tag;
+    };
+    etag = strip_weak(etag);
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view tag = list.substr(0, comma);
+        while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) {
+            tag.remove_prefix(1);
+        }
+        while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) {
+            tag.remove_suffix(1);
+        }
+        if (tag == "*" || strip_weak(tag) == etag) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        list.remove_prefix(comma + 1);
     }
-};
\ No newline at end of file
+    return false;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <zlib.h>
+#include <charconv>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "bytes_buffer.hpp"
+#include "http_header_map.hpp"
+
+// 响应正文的压缩编码；deflate 按 RFC 9110 是 zlib 格式，不是裸的 deflate 流
+enum class content_coding {
+    identity,
+    gzip,
+    deflate,
+};
+
+inline std::string_view content_coding_name(content_coding coding) {
+    switch (coding) {
+    case content_coding::gzip: return "gzip";
+    case content_coding::deflate: return "deflate";
+    default: return "identity";
+    }
+}
+
+struct http_compression_options {
+    int m_level = 6;          // 动态正文的压缩等级，0 表示不压缩
+    size_t m_min_size = 1024; // 更短的正文压缩不划算，原样发送
+};
+
+// 文本类的内容才值得压缩，png、jpeg 这些本身已经压缩过了
+inline bool http_is_compressible(std::string_view content_type) {
+    content_type = content_type.substr(0, content_type.find(';'));
+    if (content_type.substr(0, 5) == "text/") {
+        return true;
+    }
+    for (std::string_view sub: {"json", "javascript", "xml", "svg"}) {
+        if (content_type.find(sub) != std::string_view::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline std::string_view _http_trim_ows(std::string_view s) noexcept {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// 从 ";" 分隔的参数里找出 q 值（键大小写不敏感），没有 q 参数时为 1，
+// 无法解析的按 0（拒绝）处理；其他参数的值里出现 "q=" 不算
+inline double _http_accept_qvalue(std::string_view params) noexcept {
+    double q = 1;
+    while (!params.empty()) {
+        size_t semi = params.find(';');
+        std::string_view param = params.substr(0, semi);
+        params = semi == std::string_view::npos ? std::string_view{}
+                                                : params.substr(semi + 1);
+        size_t eq = param.find('=');
+        if (eq == std::string_view::npos ||
+            !http_header_map::_iequals(_http_trim_ows(param.substr(0, eq)), "q")) {
+            continue;
+        }
+        std::string_view value = _http_trim_ows(param.substr(eq + 1));
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), q);
+        if (ec != std::errc() || end != value.data() + value.size()) {
+            q = 0;
+        }
+    }
+    return q;
+}
+
+// 根据 Accept-Encoding 选择编码：q 值高的优先，相同时 gzip 优先，
+// q=0 表示拒绝；"*" 对没有单独列出的编码生效
+inline content_coding http_accept_encoding(std::string_view accept) {
+    double gzip_q = -1, deflate_q = -1, any_q = -1;
+    while (!accept.empty()) {
+        size_t comma = accept.find(',');
+        std::string_view item = accept.substr(0, comma);
+        accept = comma == std::string_view::npos ? std::string_view{}
+                                                 : accept.substr(comma + 1);
+
+        size_t semi = item.find(';');
+        std::string_view name = _http_trim_ows(item.substr(0, semi));
+        double q = semi == std::string_view::npos
+                       ? 1
+                       : _http_accept_qvalue(item.substr(semi + 1));
+        if (name == "gzip" || name == "x-gzip") {
+            gzip_q = q;
+        } else if (name == "deflate") {
+            deflate_q = q;
+        } else if (name == "*") {
+            any_q = q;
+        }
+    }
+    if (gzip_q < 0) {
+        gzip_q = any_q;
+    }
+    if (deflate_q < 0) {
+        deflate_q = any_q;
+    }
+    if (gzip_q > 0 && gzip_q >= deflate_q) {
+        return content_coding::gzip;
+    }
+    if (deflate_q > 0) {
+        return content_coding::deflate;
+    }
+    return content_coding::identity;
+}
+
+// 一次性压缩整个正文
+inline std::string http_compress(bytes_const_view data, content_coding coding,
+                                 int level) {
+    z_stream zs{};
+    int window_bits = coding == content_coding::gzip ? 15 + 16 : 15;
+    if (deflateInit2(&zs, level, Z_DEFLATED, window_bits, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::bad_alloc();
+    }
+    std::string out;
+    out.resize(deflateBound(&zs, data.size()));
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        throw std::runtime_error("deflate");
+    }
+    return out;
+}
+
+inline std::string http_compress(std::string_view data, content_coding coding,
+                                 int level) {
+    return http_compress(bytes_const_view{data.data(), data.size()}, coding, level);
+}
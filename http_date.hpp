@@ -0,0 +1,56 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <string_view>
+
+// HTTP 日期（IMF-fixdate），例如 "Sun, 06 Nov 1994 08:49:37 GMT"
+inline std::string http_date_format(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[32];
+    size_t n = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+// 解析失败返回 -1；只接受 IMF-fixdate，旧格式的日期当作没有给出
+inline time_t http_date_parse(std::string_view str) {
+    if (str.size() >= 64) {
+        return -1;
+    }
+    char buf[64];
+    str.copy(buf, str.size());
+    buf[str.size()] = '\0';
+    struct tm tm = {};
+    char const *end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == nullptr || *end != '\0') {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+// 当前时间的 Date 响应头，形如 "\r\nDate: Sun, 06 Nov 1994 08:49:37 GMT"
+// （和 write_header 写出的一样以 "\r\n" 开头）；每个线程（即每个 io_context）
+// 缓存一份，秒数变了才重新格式化，一秒内的所有响应共用同一个字符串
+// 用 CLOCK_REALTIME_COARSE 取时间，走 vDSO，比每次 strftime 便宜得多
+inline std::string_view http_date_header_line() {
+    struct cache {
+        time_t m_second = -1;
+        size_t m_size = 0;
+        char m_line[48];
+    };
+    thread_local cache c;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    if (now.tv_sec != c.m_second) {
+        struct tm tm;
+        gmtime_r(&now.tv_sec, &tm);
+        constexpr std::string_view prefix = "\r\nDate: ";
+        prefix.copy(c.m_line, prefix.size());
+        c.m_size = prefix.size() +
+                   strftime(c.m_line + prefix.size(), sizeof(c.m_line) - prefix.size(),
+                            "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        c.m_second = now.tv_sec;
+    }
+    return {c.m_line, c.m_size};
+}
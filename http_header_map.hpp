@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+struct http_header_field {
+    std::string_view key;
+    std::string_view value;
+};
+
+// 请求头：键和值都是指向头部缓冲区的 string_view，按出现的顺序平铺存放
+// 前 inline_capacity 个直接放在对象里，常见的请求解析时不需要分配内存
+// 查找时大小写不敏感地逐个比较：头部通常只有十来个，比 map 的 key 转小写、
+// 建节点都要快；同名的头部出现多次时以最后一个为准
+struct http_header_map {
+    static constexpr size_t inline_capacity = 16;
+
+    http_header_field m_inline[inline_capacity];
+    size_t m_size = 0;
+    std::vector<http_header_field> m_overflow; // 超出 inline_capacity 的部分
+
+    void clear() noexcept {
+        m_size = 0;
+        m_overflow.clear();
+    }
+
+    size_t size() const noexcept {
+        return m_size;
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    void push_back(std::string_view key, std::string_view value) {
+        if (m_size < inline_capacity) {
+            m_inline[m_size] = {key, value};
+        } else {
+            m_overflow.push_back({key, value});
+        }
+        ++m_size;
+    }
+
+    http_header_field const &operator[](size_t i) const noexcept {
+        return i < inline_capacity ? m_inline[i] : m_overflow[i - inline_capacity];
+    }
+
+    // 没有这个头部时返回 nullptr
+    std::string_view const *find(std::string_view key) const noexcept {
+        for (size_t i = m_size; i-- > 0;) {
+            auto &field = (*this)[i];
+            if (_iequals(field.key, key)) {
+                return &field.value;
+            }
+        }
+        return nullptr;
+    }
+
+    // 没有这个头部时返回空
+    std::string_view get(std::string_view key) const noexcept {
+        auto *value = find(key);
+        return value ? *value : std::string_view();
+    }
+
+    bool contains(std::string_view key) const noexcept {
+        return find(key) != nullptr;
+    }
+
+    static bool _iequals(std::string_view a, std::string_view b) noexcept {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i) {
+            char x = a[i], y = b[i];
+            if ('A' <= x && x <= 'Z') {
+                x += 'a' - 'A';
+            }
+            if ('A' <= y && y <= 'Z') {
+                y += 'a' - 'A';
+            }
+            if (x != y) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+// 头部扫描：一遍找出所有 "\r\n" 行尾和每行第一个 ':'，按 32 字节一块比较，
+// 得到 '\n' 和 ':' 所在位置的位图，再只处理位图里的这几个位置；
+// 之前是 find("\r\n\r\n")、逐行 find("\r\n")、find(": ") 分几遍扫描同样的字节
+// 同一个二进制在支持 AVX2 的机器上用 AVX2，否则用 SSE2（x86-64 都有），
+// 其他架构退回逐字节比较；选择在启动时做一次
+
+// 对 p 开始的 nblocks 个 32 字节块，分别求出其中 '\n' 和 ':' 的位图，
+// masks[k] 的第 i 位对应 p[k * 32 + i]；循环放在各自的 target 函数里，
+// 整个循环都能用上对应的指令，每批只有一次间接调用
+inline void _http_scan_blocks_scalar(char const *p, size_t nblocks,
+                                     uint32_t *masks) noexcept {
+    for (size_t k = 0; k < nblocks; ++k, p += 32) {
+        uint32_t mask = 0;
+        for (int i = 0; i < 32; ++i) {
+            if (p[i] == '\n' || p[i] == ':') {
+                mask |= uint32_t(1) << i;
+            }
+        }
+        masks[k] = mask;
+    }
+}
+
+#if HTTP_SCAN_X86
+__attribute__((target("sse2"))) inline void
+_http_scan_blocks_sse2(char const *p, size_t nblocks, uint32_t *masks) noexcept {
+    __m128i nl = _mm_set1_epi8('\n');
+    __m128i colon = _mm_set1_epi8(':');
+    for (size_t k = 0; k < nblocks; ++k, p += 32) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + 16));
+        uint32_t lo = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(a, nl), _mm_cmpeq_epi8(a, colon))));
+        uint32_t hi = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(b, nl), _mm_cmpeq_epi8(b, colon))));
+        masks[k] = lo | hi << 16;
+    }
+}
+
+__attribute__((target("avx2"))) inline void
+_http_scan_blocks_avx2(char const *p, size_t nblocks, uint32_t *masks) noexcept {
+    __m256i nl = _mm256_set1_epi8('\n');
+    __m256i colon = _mm256_set1_epi8(':');
+    for (size_t k = 0; k < nblocks; ++k, p += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+        masks[k] = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(a, nl), _mm256_cmpeq_epi8(a, colon))));
+    }
+}
+#endif
+
+using _http_scan_blocks_fn = void (*)(char const *, size_t, uint32_t *) noexcept;
+
+inline _http_scan_blocks_fn const _http_scan_blocks = [] {
+#if HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &_http_scan_blocks_avx2;
+    }
+    return &_http_scan_blocks_sse2;
+#else
+    return &_http_scan_blocks_scalar;
+#endif
+}();
+
+// 增量地扫描一段不断变长的头部缓冲区，每次只看新追加的字节，
+// 请求被拆成很多次读取也不会重复扫描；行的下标随缓冲区复用，不释放容量
+struct http_header_scanner {
+    static constexpr uint32_t npos = static_cast<uint32_t>(-1);
+
+    struct line {
+        uint32_t m_begin; // 行首
+        uint32_t m_end;   // 行尾的 '\r'
+        uint32_t m_colon; // 本行第一个 ':'，没有时为 npos
+    };
+
+    std::vector<line> m_lines; // 已经结束的非空行，第一行是首行
+    uint32_t m_scanned = 0;    // [0, m_scanned) 已经扫描过
+    uint32_t m_line_begin = 0; // 当前（还没结束的）行的行首
+    uint32_t m_colon = npos;   // 当前行第一个 ':'
+    uint32_t m_header_end = npos; // 最后一行的行尾，即不含空行的头部长度
+    uint32_t m_body_begin = npos; // 空行之后第一个字节
+
+    void reset_state() noexcept {
+        m_lines.clear();
+        m_scanned = 0;
+        m_line_begin = 0;
+        m_colon = npos;
+        m_header_end = npos;
+        m_body_begin = npos;
+    }
+
+    // 扫描 data[m_scanned, size)，data 的前 m_scanned 个字节必须和上次相同
+    // 遇到空行（头部结束）时返回 true，之后的字节不再扫描
+    bool scan(char const *data, size_t size) {
+        uint32_t i = m_scanned;
+        uint32_t n = static_cast<uint32_t>(size);
+        constexpr size_t batch = 16; // 一批 512 字节，一般的请求头一两批就够
+        uint32_t masks[batch];
+        while (i + 32 <= n) {
+            size_t nblocks = std::min<size_t>((n - i) / 32, batch);
+            _http_scan_blocks(data + i, nblocks, masks);
+            for (size_t k = 0; k < nblocks; ++k, i += 32) {
+                for (uint32_t mask = masks[k]; mask; mask &= mask - 1) {
+                    uint32_t pos = i + static_cast<uint32_t>(__builtin_ctz(mask));
+                    if (_on_special(data, pos)) {
+                        return true;
+                    }
+                }
+            }
+        }
+        for (; i < n; ++i) {
+            if ((data[i] == '\n' || data[i] == ':') && _on_special(data, i)) {
+                return true;
+            }
+        }
+        m_scanned = n;
+        return false;
+    }
+
+    bool _on_special(char const *data, uint32_t pos) {
+        if (data[pos] == ':') {
+            if (m_colon == npos) {
+                m_colon = pos;
+            }
+            return false;
+        }
+        // 只有 "\r\n" 算行尾；前一个字节可能在上一次读到的块里
+        if (pos == 0 || data[pos - 1] != '\r' || pos - 1 < m_line_begin) {
+            return false;
+        }
+        uint32_t end = pos - 1;
+        if (end != m_line_begin) {
+            m_lines.push_back({m_line_begin, end, m_colon});
+        } else if (!m_lines.empty()) {
+            // 空行：头部结束
+            m_header_end = m_lines.back().m_end;
+            m_body_begin = pos + 1;
+            m_scanned = pos + 1;
+            return true;
+        }
+        // 首行之前的空行直接忽略（RFC 9112 2.2）
+        m_line_begin = pos + 1;
+        m_colon = npos;
+        return false;
+    }
+};
@@ -1,13 +1,34 @@
 #pragma once
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 #include "expected.hpp"
 #include "io_context.hpp"
 #include "stop_source.hpp"
 #include "http_codec.hpp"
-#include "opencv2/opencv.hpp"
+#include "iobuf.hpp"
+#include "object_pool.hpp"
+#include "static_file_cache.hpp"
+#include "http_date.hpp"
+#include "http_compress.hpp"
+
+// 每个路由各自的正文处理方式
+struct http_route_options {
+    // 正文超过这个长度时不读取，直接回复 413 并关闭连接
+    size_t m_max_body_size = 16 * 1024 * 1024;
+    // 为 true 时头部解析完就调用处理函数，正文由 http_request::read_body
+    // 逐块读取，不在内存中积累；否则读完整个正文才调用，正文在 body 中
+    bool m_streaming = false;
+};
 
 struct http_server : std::enable_shared_from_this<http_server> {
     using pointer = std::shared_ptr<http_server>;
@@ -16,53 +37,422 @@ struct http_server : std::enable_shared_from_this<http_server> {
         return std::make_shared<pointer::element_type>();
     }
 
+    // 每个响应都有的状态行、Date、Server、Connection：状态行查表，
+    // Date 每秒格式化一次，后两行是拼好的常量，都是整块追加
+    static void _begin_response(http_response_writer<> &writer, int status,
+                                bool keep_alive = true) {
+        writer.begin_header(status);
+        writer.write_raw(http_date_header_line());
+        writer.write_raw(keep_alive ? "\r\nServer: co_http\r\nConnection: keep-alive"
+                                    : "\r\nServer: co_http\r\nConnection: close");
+    }
+
     struct http_request {
-        std::string url;
+        // url、con_type、headers 都指向连接的头部缓冲区，不复制；
+        // 只在响应发出之前有效，需要保留到之后的话自己复制一份
+        std::string_view url;
         http_method method; // GET, POST, PUT, ...
-        std::string body;
-        std::string con_type;
+        iobuf body;         // 按读到的块分段，需要连续内存时用 body.to_string()
+        std::string_view con_type;
+        http_header_map headers; // 查找时大小写不敏感
 
         http_response_writer<> *m_res_writer = nullptr;
+        static_file_cache *m_static_cache = nullptr;
+        http_compression_options const *m_compression = nullptr;
         callback<> m_resume;
+        // 由 write_file_response 设置：头部发出后用 sendfile 发送的文件正文
+        file_descriptor m_file_body;
+        off_t m_file_offset = 0;
+        size_t m_file_size = 0;
+        // 流式正文的路由才有：从连接读取下一块正文
+        callback<bytes_view, callback<expected<size_t>>> m_body_reader;
+        // 分块响应用：把目前写好的部分发出去，不结束请求，发完后调用参数
+        callback<callback<>> m_flush;
+
+        // 只能在以流式正文注册的路由里使用：读取下一块正文到 buf，
+        // 和 async_read 一样，读到 0 个字节表示正文已经结束
+        // 不调用就不会继续从连接读取，处理函数可以借此控制读取速度
+        // （例如写完磁盘再读下一块）；正文没有读完就写出响应的话，
+        // 响应发出后连接会被关闭
+        // 读取出错时连接已经被关闭、请求被放弃，处理函数只需释放自己的状态，
+        // 不要再写响应
+        void read_body(bytes_view buf, callback<expected<size_t>> cb) {
+            assert(m_body_reader);
+            m_body_reader(multishot_call, buf, std::move(cb));
+        }
+
+        // url 中 '?' 之前的部分，路由按它匹配
+        static std::string_view path_of(std::string_view url) noexcept {
+            return url.substr(0, url.find('?'));
+        }
+
+        std::string_view path() const noexcept {
+            return path_of(url);
+        }
+
+        // 查询字符串中 name 对应的值，没有时返回空；不做百分号解码
+        std::string_view query(std::string_view name) const noexcept {
+            std::string_view rest = url;
+            size_t pos = rest.find('?');
+            if (pos == rest.npos) {
+                return {};
+            }
+            rest.remove_prefix(pos + 1);
+            while (!rest.empty()) {
+                std::string_view param = rest.substr(0, rest.find('&'));
+                rest.remove_prefix(std::min(param.size() + 1, rest.size()));
+                size_t eq = param.find('=');
+                if (param.substr(0, eq) == name) {
+                    return eq == param.npos ? std::string_view() : param.substr(eq + 1);
+                }
+            }
+            return {};
+        }
+
+        // 没有这个请求头时返回空
+        std::string_view header(std::string_view name) const {
+            return headers.get(name);
+        }
 
         void write_response(
             int status, std::string_view content,
             std::string_view content_type = "text/plain;charset=utf-8") {
-            m_res_writer->begin_header(status);
-            m_res_writer->write_header("Server", "co_http");
+            bool vary = false;
+            if (_write_compressed_response(status, content, content_type, vary)) {
+                return;
+            }
+            _write_response_header(status, content.size(), content_type,
+                                   content_coding::identity, vary);
+            if (method != http_method::HEAD) {
+                m_res_writer->write_body(content);
+            }
+            m_resume();
+        }
+
+        // 传入 std::string 右值时直接接管它的内存，正文不再复制
+        template <class String, std::enable_if_t<
+                                    std::is_same_v<String, std::string>, int> = 0>
+        void write_response(
+            int status, String &&content,
+            std::string_view content_type = "text/plain;charset=utf-8") {
+            bool vary = false;
+            if (_write_compressed_response(status, content, content_type, vary)) {
+                return;
+            }
+            _write_response_header(status, content.size(), content_type,
+                                   content_coding::identity, vary);
+            if (method != http_method::HEAD) {
+                m_res_writer->write_body(std::move(content));
+            }
+            m_resume();
+        }
+
+        // 分块发送（Transfer-Encoding: chunked）：先只发出头部，正文边生成边用
+        // write_chunk 发送，每块发送完成后调用 cb 再写下一块，生成得再快
+        // 也不会在内存里堆积；最后调用 end_chunked_response
+        // 连接出错时不再调用 cb：连接被关闭，cb 和请求一起被丢弃，
+        // 处理函数在 cb 里保存的状态随之释放
+        void begin_chunked_response(
+            int status, callback<> cb,
+            std::string_view content_type = "text/plain;charset=utf-8") {
+            _begin_response(*m_res_writer, status);
             m_res_writer->write_header("Content-type", content_type);
-            m_res_writer->write_header("Connection", "keep-alive");
+            m_res_writer->write_header("Transfer-Encoding", "chunked");
+            m_res_writer->end_header();
+            m_flush(multishot_call, std::move(cb));
+        }
 
-            if (post_image_process::judgePostType(con_type) == POST_TYPE::image) {
-                std::string image_string = post_image_process::extraMulti(body);
-                std::vector<char> img_data(image_string.begin(), image_string.end());
-                cv::Mat img = cv::imdecode(img_data, cv::IMREAD_COLOR);
-                std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION, 1};
-                std::string path = "test.png";
-                cv::imwrite(path, img, params);
+        void write_chunk(std::string_view data, callback<> cb) {
+            if (method != http_method::HEAD) {
+                m_res_writer->write_chunk(data);
             }
+            m_flush(multishot_call, std::move(cb));
+        }
+
+        template <class String, std::enable_if_t<
+                                    std::is_same_v<String, std::string>, int> = 0>
+        void write_chunk(String &&data, callback<> cb) {
+            if (method != http_method::HEAD) {
+                m_res_writer->write_chunk(std::move(data));
+            }
+            m_flush(multishot_call, std::move(cb));
+        }
+
+        void end_chunked_response() {
+            if (method != http_method::HEAD) {
+                m_res_writer->end_chunks();
+            }
+            m_resume();
+        }
 
-            m_res_writer->write_header("Content-length",
-                                       std::to_string(content.size()));
+        // 重定向（301、302、303、307、308），正文为空
+        void write_redirect(int status, std::string_view location) {
+            _begin_response(*m_res_writer, status);
+            m_res_writer->write_header("Location", location);
+            m_res_writer->write_content_length(0);
             m_res_writer->end_header();
-            m_res_writer->write_body(content);
             m_resume();
         }
+
+        // 客户端接受并且值得压缩时压缩后写出，返回 true；否则返回 false，
+        // 由调用者原样写出，vary 表示是否需要带上 Vary 头
+        bool _write_compressed_response(int status, std::string_view content,
+                                        std::string_view content_type,
+                                        bool &vary) {
+            if (!m_compression || m_compression->m_level == 0 ||
+                content.size() < m_compression->m_min_size ||
+                !http_is_compressible(content_type)) {
+                return false;
+            }
+            vary = true;
+            content_coding coding = http_accept_encoding(header("accept-encoding"));
+            if (coding == content_coding::identity) {
+                return false;
+            }
+            std::string compressed =
+                http_compress(content, coding, m_compression->m_level);
+            if (compressed.size() >= content.size()) {
+                return false;
+            }
+            _write_response_header(status, compressed.size(), content_type,
+                                   coding, vary);
+            if (method != http_method::HEAD) {
+                m_res_writer->write_body(std::move(compressed));
+            }
+            m_resume();
+            return true;
+        }
+
+        // 文件正文不读进用户态，由连接在发出头部后直接 sendfile
+        void write_file_response(std::string const &path,
+                                 std::string_view content_type) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                return write_response(404, "404 Not Found");
+            }
+            return write_file_response(file_descriptor(fd), content_type);
+        }
+
+        void write_file_response(file_descriptor file,
+                                 std::string_view content_type) {
+            struct stat st;
+            if (fstat(file.m_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+                return write_response(404, "404 Not Found");
+            }
+            std::string etag = static_file_cache::make_etag(st.st_size, st.st_mtim);
+            std::string last_modified = http_date_format(st.st_mtim.tv_sec);
+            if (_not_modified(etag, st.st_mtim.tv_sec)) {
+                return _write_not_modified(etag, last_modified, false);
+            }
+            size_t first = 0, length = st.st_size;
+            int status = _select_range(etag, st.st_mtim.tv_sec, st.st_size,
+                                       first, length);
+            if (status == 416) {
+                return _write_range_not_satisfiable(st.st_size);
+            }
+            _write_static_header(status, content_type, etag, last_modified,
+                                 false, first, length, st.st_size);
+            if (method != http_method::HEAD) {
+                m_file_body = std::move(file);
+                m_file_offset = first;
+                m_file_size = length;
+            }
+            m_resume();
+        }
+
+        // 静态文件：命中缓存时直接发送预先生成的响应头和 mmap 的内容，
+        // 不访问文件系统；不适合缓存的（太大）退回 write_file_response
+        // 两者都支持条件请求（304）和单段的 Range（206）
+        // 文本类文件按 Accept-Encoding 发送缓存的压缩版本，Range 请求总是针对原文件
+        void write_static_response(std::string const &path,
+                                   std::string_view content_type) {
+            auto entry = m_static_cache->lookup(path, content_type);
+            if (!entry) {
+                return write_file_response(path, content_type);
+            }
+            time_t mtime = entry->m_mtime.tv_sec;
+            bool vary = entry->m_compressible;
+            if (vary && header("range").empty()) {
+                auto *v = m_static_cache->compressed(
+                    *entry, http_accept_encoding(header("accept-encoding")));
+                if (v) {
+                    if (_not_modified(v->m_etag, mtime)) {
+                        return _write_not_modified(v->m_etag,
+                                                   entry->m_last_modified, vary);
+                    }
+                    _begin_response(*m_res_writer, 200);
+                    auto &body = m_res_writer->body();
+                    body.append_foreign(v->m_header, [entry] {});
+                    if (method != http_method::HEAD) {
+                        body.append_foreign(v->content(), [entry] {});
+                    }
+                    return m_resume();
+                }
+            }
+            if (_not_modified(entry->m_etag, mtime)) {
+                return _write_not_modified(entry->m_etag, entry->m_last_modified,
+                                           vary);
+            }
+            size_t first = 0, length = entry->m_size;
+            int status = _select_range(entry->m_etag, mtime, entry->m_size,
+                                       first, length);
+            if (status == 416) {
+                return _write_range_not_satisfiable(entry->m_size);
+            }
+            // 条目在发送完成前可能被 inotify 作废，由正文的段持有它的引用
+            auto &body = m_res_writer->body();
+            if (status == 200) {
+                _begin_response(*m_res_writer, 200);
+                body.append_foreign(entry->m_header, [entry] {});
+            } else {
+                _write_static_header(status, content_type, entry->m_etag,
+                                     entry->m_last_modified, vary, first,
+                                     length, entry->m_size);
+            }
+            if (method != http_method::HEAD) {
+                body.append_foreign(entry->content().subspan(first, length),
+                                    [entry] {});
+            }
+            m_resume();
+        }
+
+        // HEAD 的响应头和 GET 一样（包括 Content-length），只是不带正文
+        bool _is_get_or_head() const noexcept {
+            return method == http_method::GET || method == http_method::HEAD;
+        }
+
+        // If-None-Match 优先；没有时才看 If-Modified-Since
+        bool _not_modified(std::string_view etag, time_t mtime) const {
+            if (!_is_get_or_head()) {
+                return false;
+            }
+            std::string_view inm = header("if-none-match");
+            if (!inm.empty()) {
+                return http_etag_list_match(inm, etag);
+            }
+            std::string_view ims = header("if-modified-since");
+            if (!ims.empty()) {
+                time_t since = http_date_parse(ims);
+                return since != -1 && mtime <= since;
+            }
+            return false;
+        }
+
+        // 返回 200（完整内容）、206（[first, first + length)）或者 416
+        int _select_range(std::string_view etag, time_t mtime, size_t size,
+                          size_t &first, size_t &length) const {
+            first = 0;
+            length = size;
+            std::string_view range = header("range");
+            if (range.empty() || method != http_method::GET) {
+                return 200;
+            }
+            // If-Range 不匹配说明客户端手上的部分已经过时，要完整重新下载
+            std::string_view if_range = header("if-range");
+            if (!if_range.empty()) {
+                bool is_etag = if_range.front() == '"' ||
+                               if_range.substr(0, 2) == "W/";
+                // 这里要求强比较：弱 ETag 永远不匹配
+                if (is_etag ? if_range != etag
+                            : http_date_parse(if_range) != mtime) {
+                    return 200;
+                }
+            }
+            switch (http_parse_range(range, size, first, length)) {
+            case http_range_result::satisfiable: return 206;
+            case http_range_result::unsatisfiable: return 416;
+            default: first = 0; length = size; return 200;
+            }
+        }
+
+        void _write_static_header(int status, std::string_view content_type,
+                                  std::string_view etag,
+                                  std::string_view last_modified, bool vary,
+                                  size_t first, size_t length, size_t size) {
+            _begin_response(*m_res_writer, status);
+            m_res_writer->write_header("Content-type", content_type);
+            m_res_writer->write_header("ETag", etag);
+            m_res_writer->write_header("Last-Modified", last_modified);
+            m_res_writer->write_header("Accept-Ranges", "bytes");
+            if (vary) {
+                m_res_writer->write_header("Vary", "Accept-Encoding");
+            }
+            if (status == 206) {
+                m_res_writer->write_header(
+                    "Content-Range", "bytes " + std::to_string(first) + "-" +
+                                         std::to_string(first + length - 1) +
+                                         "/" + std::to_string(size));
+            }
+            m_res_writer->write_content_length(length);
+            m_res_writer->end_header();
+        }
+
+        void _write_not_modified(std::string_view etag,
+                                 std::string_view last_modified, bool vary) {
+            _begin_response(*m_res_writer, 304);
+            m_res_writer->write_header("ETag", etag);
+            m_res_writer->write_header("Last-Modified", last_modified);
+            if (vary) {
+                m_res_writer->write_header("Vary", "Accept-Encoding");
+            }
+            m_res_writer->end_header();
+            m_resume();
+        }
+
+        void _write_range_not_satisfiable(size_t size) {
+            _begin_response(*m_res_writer, 416);
+            m_res_writer->write_header("Content-Range",
+                                       "bytes */" + std::to_string(size));
+            m_res_writer->write_content_length(0);
+            m_res_writer->end_header();
+            m_resume();
+        }
+
+        void _write_response_header(
+            int status, size_t content_length, std::string_view content_type,
+            content_coding coding = content_coding::identity, bool vary = false) {
+            _begin_response(*m_res_writer, status);
+            m_res_writer->write_header("Content-type", content_type);
+            if (coding != content_coding::identity) {
+                m_res_writer->write_header("Content-Encoding",
+                                           content_coding_name(coding));
+            }
+            if (vary) {
+                m_res_writer->write_header("Vary", "Accept-Encoding");
+            }
+            m_res_writer->write_content_length(content_length);
+            m_res_writer->end_header();
+        }
     };
 
     struct http_router {
-        std::map<std::string, callback<http_request &>> m_routes;
+        struct _route {
+            callback<http_request &> m_cb;
+            http_route_options m_options;
+        };
+
+        std::map<std::string, _route> m_routes;
+        http_route_options m_default_options; // 没有匹配的路径时使用
 
-        void route(std::string url, callback<http_request &> cb) {
+        void route(std::string url, callback<http_request &> cb,
+                   http_route_options options = {}) {
             // 为指定路径设置回调函数
-            m_routes.insert_or_assign(url, std::move(cb));
+            m_routes.insert_or_assign(url, _route{std::move(cb), options});
+        }
+
+        http_route_options const &options(std::string_view url) const {
+            auto it = m_routes.find(std::string(http_request::path_of(url)));
+            if (it != m_routes.end()) {
+                return it->second.m_options;
+            }
+            return m_default_options;
         }
 
         void do_handle(http_request &request) {
-            // 寻找匹配的路径
-            auto it = m_routes.find(request.url);
+            // 寻找匹配的路径（不含查询字符串）
+            auto it = m_routes.find(std::string(request.path()));
             if (it != m_routes.end()) {
-                return it->second(multishot_call, request);
+                return it->second.m_cb(multishot_call, request);
             }
             // fmt::println("找不到路径: {}", request.url);
             return request.write_response(404, "404 Not Found");
@@ -77,38 +467,131 @@ struct http_server : std::enable_shared_from_this<http_server> {
         http_response_writer<> m_res_writer;
         http_router *m_router = nullptr;
         http_request m_request;
+        iobuf m_output; // 正在发送的响应：头部缓冲区加上正文的各个段
+        std::vector<struct iovec> m_iov; // m_output 对应的 iovec，容量随连接复用
+
+        // 空闲超时：每次读取只记下时间戳，由一个懒惰续期的定时器统一检查
+        stop_state m_stop_io;    // 整个连接共用，取消正在等待的读取
+        stop_state m_idle_stop;  // 连接销毁时撤掉空闲定时器
+        stop_callback m_server_stop_cb; // 服务器停止时取消本连接的读写
+        timer_context::clock::duration m_idle_timeout{};
+        timer_context::clock::time_point m_last_active;
+        bool m_reading = false;
+
+        // 流式正文：头部之后已经读到的部分，以及还没有从连接读取的长度；
+        // 分块编码时长度未知，由解析器解码并判断是否结束
+        iobuf m_body_pending;
+        size_t m_body_remaining = 0;
+        bool m_body_chunked = false;
+        size_t m_max_body_size = 0; // 当前路由的正文上限，分块编码时边收边检查
+        bool m_close_after_write = false;
+        // 流水线：已经读到、属于后续请求的字节，容量随连接复用
+        std::string m_pipelined;
+        size_t m_batched = 0; // m_output 里排队的响应个数
+        callback<> m_after_flush;
+        static constexpr size_t _max_batched = 16;
+        // 关闭前丢弃对方还在发送的正文：最多读这么多、等这么久
+        size_t m_drained = 0;
+        static constexpr size_t _max_drain = 1024 * 1024;
+        static constexpr auto _drain_timeout = std::chrono::seconds(2);
 
         using pointer = std::shared_ptr<http_connection_handler>;
 
+        // 连接对象来自线程局部的对象池，关闭后连同读缓冲、解析器里的
+        // 缓冲区一起回收，频繁建立的短连接不再每次都走 malloc
         static pointer make() {
-            return std::make_shared<pointer::element_type>();
+            return object_pool<http_connection_handler>::make_shared();
+        }
+
+        // 回到对象池之前调用：撤掉空闲定时器、关闭连接，只清空内容不释放容量
+        void reset_state() {
+            m_server_stop_cb.reset();
+            m_idle_stop.request_stop();
+            m_conn = async_file{};
+            m_req_parser.reset_state();
+            m_res_writer.reset_state();
+            m_request.url = {};
+            m_request.body.clear();
+            m_request.con_type = {};
+            m_request.m_resume = nullptr;
+            m_request.m_file_body = file_descriptor();
+            m_request.headers.clear();
+            m_request.m_body_reader = nullptr;
+            m_request.m_flush = nullptr;
+            m_output.clear();
+            m_router = nullptr;
+            m_reading = false;
+            m_body_pending.clear();
+            m_body_remaining = 0;
+            m_body_chunked = false;
+            m_close_after_write = false;
+            m_pipelined.clear();
+            m_batched = 0;
+            m_after_flush = nullptr;
+            m_drained = 0;
         }
 
-        void do_start(http_router *router, int connfd) {
+        void do_start(http_router *router, static_file_cache *static_cache,
+                      http_compression_options const *compression, int connfd,
+                      timer_context::clock::duration idle_timeout,
+                      stop_state &server_stop) {
             m_router = router;
+            m_request.m_static_cache = static_cache;
+            m_request.m_compression = compression;
             m_conn = async_file{connfd};
+            // 每个响应都已经合并成一次 writev（或 writev 加 sendfile），
+            // Nagle 只会让紧跟在头部后面的正文等待对方的延迟确认
+            int on = 1;
+            setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            m_idle_timeout = idle_timeout;
+            m_stop_io.reset();
+            m_idle_stop.reset();
+            // 空闲的长连接一直挂着读取，epoll 后端下等待者又持有连接本身，
+            // 循环退出之后只能靠这里取消，否则连接永远不会关闭
+            server_stop.add_stop_callback(m_server_stop_cb, [this] {
+                m_stop_io.request_stop();
+            });
+            m_last_active = io_context::get().coarse_now();
+            if (m_idle_timeout > timer_context::clock::duration::zero()) {
+                do_arm_idle_timer(m_idle_timeout);
+            }
             return do_read();
         }
 
+        void do_arm_idle_timer(timer_context::clock::duration dt) {
+            io_context::get().set_coarse_timeout(
+                dt,
+                [weak = weak_from_this()] {
+                    auto self = weak.lock();
+                    if (!self) {
+                        return; // 连接已经关闭，定时器被撤销
+                    }
+                    auto idle = io_context::get().coarse_now() -
+                                self->m_last_active;
+                    if (self->m_reading && idle >= self->m_idle_timeout) {
+                        // 等待请求的时间过长，视为对方放弃，取消读取并关闭连接
+                        return self->m_stop_io.request_stop();
+                    }
+                    // 期间有过活动（或正在处理请求），按最后一次活动时间续期
+                    auto remain = self->m_idle_timeout - idle;
+                    if (!self->m_reading || remain <= decltype(remain)::zero()) {
+                        remain = self->m_idle_timeout;
+                    }
+                    return self->do_arm_idle_timer(remain);
+                },
+                m_idle_stop);
+        }
+
         void do_read() {
             // 注意：TCP 基于流，可能粘包
             // fmt::println("开始读取...");
-            // 设置一个 3 秒的定时器，若 3
-            // 秒内没有读到任何请求，则视为对方放弃，关闭连接
-            stop_source stop_io(std::in_place);
-            stop_source stop_timer(std::in_place);
-            io_context::get().set_timeout(
-                std::chrono::seconds(10),
-                [stop_io] {
-                    stop_io.request_stop(); // 定时器先完成时，取消读取
-                },
-                stop_timer);
+            m_reading = true;
+            m_last_active = io_context::get().coarse_now();
             // 开始读取
             return m_conn.async_read(
                 m_readbuf,
-                [self = shared_from_this(),
-                 stop_timer](expected<size_t> ret) {
-                    stop_timer.request_stop(); // 读取先完成时，取消定时器
+                [self = shared_from_this()](expected<size_t> ret) {
+                    self->m_reading = false;
                     if (ret.error()) {
                         // fmt::println("读取出错 {}，放弃连接", strerror(-ret.error()));
                         return;
@@ -121,15 +604,247 @@ struct http_server : std::enable_shared_from_this<http_server> {
                     }
                     // fmt::println("读取到了 {} 个字节: {}", n, std::string_view{self->m_readbuf.data(), n});
                     // 成功读取，则推入解析
-                    self->m_req_parser.push_chunk(
-                        self->m_readbuf.subspan(0, n));
-                    if (!self->m_req_parser.request_finished()) {
-                        return self->do_read();
-                    } else {
-                        return self->do_handle();
+                    return self->do_parse(self->m_readbuf.subspan(0, n));
+                },
+                m_stop_io);
+        }
+
+        // 新读到的数据交给解析器；请求结束之后多出来的字节是客户端用流水线
+        // 接着发来的请求，留在 m_pipelined 里，当前请求处理完再解析
+        void do_parse(bytes_const_view data) {
+            bool had_header = m_req_parser.header_finished();
+            size_t used = m_req_parser.push_chunk(data);
+            m_pipelined.append(data.data() + used, data.size() - used);
+            return do_parsed(had_header);
+        }
+
+        // 不用再 read，直接从上次留下的字节里解析下一个请求
+        void do_parse_pipelined() {
+            if (m_pipelined.empty()) {
+                return do_read_more();
+            }
+            bool had_header = m_req_parser.header_finished();
+            size_t used = m_req_parser.push_chunk(
+                bytes_const_view{m_pipelined.data(), m_pipelined.size()});
+            m_pipelined.erase(0, used);
+            return do_parsed(had_header);
+        }
+
+        void do_parsed(bool had_header) {
+            if (!had_header && m_req_parser.header_finished()) {
+                return do_header();
+            }
+            if (int status = _body_error()) {
+                return do_reject(status, status == 400 ? "400 Bad Request"
+                                                       : "413 Payload Too Large");
+            }
+            if (!m_req_parser.request_finished()) {
+                return do_read_more();
+            }
+            return do_handle();
+        }
+
+        // 需要更多数据才能继续：先把排队的响应发出去，对方可能要收到它们
+        // 才会发送后面的内容
+        void do_read_more() {
+            if (!m_output.empty()) {
+                return do_flush_then([self = shared_from_this()] {
+                    self->do_read();
+                });
+            }
+            return do_read();
+        }
+
+        // 发出 m_output 里排队的响应，然后调用 next（而不是结束当前请求）
+        void do_flush_then(callback<> next) {
+            m_after_flush = std::move(next);
+            return do_write();
+        }
+
+        // 头部刚解析完：先按路由的设置检查正文长度，再决定是否积累正文
+        void do_header() {
+            auto const &options = m_router->options(m_req_parser.url());
+            m_max_body_size = options.m_max_body_size;
+            if (int status = _body_error()) {
+                return do_reject(status, status == 400 ? "400 Bad Request"
+                                                       : "413 Payload Too Large");
+            }
+            if (!m_req_parser.request_finished() && m_req_parser.body().empty()) {
+                // 客户端在等 100 Continue 才发送正文（curl 对较大的正文默认如此）
+                if (http_header_map::_iequals(m_req_parser.headers().get("expect"),
+                                              "100-continue")) {
+                    return do_send_continue(options.m_streaming);
+                }
+            }
+            return do_read_body_or_handle(options.m_streaming);
+        }
+
+        // 400：长度或者分块格式不对；413：超过路由的上限（分块编码的正文
+        // 事先不知道长度，收到的部分一超过就拒绝）；0：没有问题
+        int _body_error() const {
+            if (m_req_parser.bad_content_length() || m_req_parser.bad_chunked()) {
+                return 400;
+            }
+            if (m_req_parser.content_length() > m_max_body_size ||
+                m_req_parser.body_size() > m_max_body_size) {
+                return 413;
+            }
+            return 0;
+        }
+
+        // 流式正文还没有读完：剩下的数据没法和下一个请求区分开
+        bool _body_unread() const {
+            return m_body_remaining != 0 || !m_body_pending.empty() ||
+                   (m_body_chunked && !m_req_parser.request_finished());
+        }
+
+        void do_read_body_or_handle(bool streaming) {
+            if (streaming) {
+                return do_handle_streaming();
+            }
+            if (!m_req_parser.request_finished()) {
+                return do_read_more();
+            }
+            return do_handle();
+        }
+
+        void do_send_continue(bool streaming) {
+            if (!m_output.empty()) {
+                return do_flush_then([self = shared_from_this(), streaming] {
+                    self->do_send_continue(streaming);
+                });
+            }
+            static constexpr std::string_view msg = "HTTP/1.1 100 Continue\r\n\r\n";
+            m_iov.resize(1);
+            m_iov[0].iov_base = const_cast<char *>(msg.data());
+            m_iov[0].iov_len = msg.size();
+            return m_conn.async_writev(
+                m_iov.data(), m_iov.size(),
+                [self = shared_from_this(), streaming](expected<size_t> ret) {
+                    if (ret.error()) {
+                        return self->do_abort();
+                    }
+                    return self->do_read_body_or_handle(streaming);
+                });
+        }
+
+        // 不读取正文，发出错误响应后关闭连接
+        void do_reject(int status, std::string_view message) {
+            if (!m_output.empty()) {
+                return do_flush_then([self = shared_from_this(), status, message] {
+                    self->do_reject(status, message);
+                });
+            }
+            m_req_parser.reset_state();
+            _begin_response(m_res_writer, status, false);
+            m_res_writer.write_header("Content-type", "text/plain;charset=utf-8");
+            m_res_writer.write_content_length(message.size());
+            m_res_writer.end_header();
+            m_res_writer.write_body(message);
+            m_close_after_write = true;
+            m_output.append_foreign(m_res_writer.buffer());
+            m_output.append(std::move(m_res_writer.body()));
+            return do_write();
+        }
+
+        // 处理函数会直接从连接读取正文，排队的响应要先发出去
+        void do_handle_streaming() {
+            if (!m_output.empty()) {
+                return do_flush_then([self = shared_from_this()] {
+                    self->do_handle_streaming();
+                });
+            }
+            m_body_pending = std::move(m_req_parser.body());
+            m_body_chunked = m_req_parser.chunked();
+            if (!m_body_chunked) {
+                m_body_remaining = m_req_parser.content_length() - m_body_pending.size();
+            }
+            m_request.m_body_reader = [this](bytes_view buf,
+                                             callback<expected<size_t>> cb) {
+                return do_read_body(buf, std::move(cb));
+            };
+            return do_handle();
+        }
+
+        void do_read_body(bytes_view buf, callback<expected<size_t>> cb) {
+            if (!m_body_pending.empty()) {
+                size_t n = std::min(buf.size(), m_body_pending.size());
+                m_body_pending.slice(0, n).copy_to(buf.data());
+                m_body_pending.consume(n);
+                return io_context::get().complete(cb, n);
+            }
+            if (m_body_chunked) {
+                return do_read_chunked_body(buf, std::move(cb));
+            }
+            if (m_body_remaining == 0) {
+                return io_context::get().complete(cb, 0);
+            }
+            m_reading = true;
+            m_last_active = io_context::get().coarse_now();
+            return m_conn.async_read(
+                buf.subspan(0, std::min(buf.size(), m_body_remaining)),
+                [self = shared_from_this(), cb = std::move(cb)](
+                    expected<size_t> ret) mutable {
+                    self->m_reading = false;
+                    if (!ret.error() && ret.value() == 0) {
+                        ret = -ECONNRESET; // 正文还没有结束，对方就关闭了连接
+                    }
+                    if (ret.error()) {
+                        self->do_abort();
+                        return cb(ret);
+                    }
+                    self->m_body_remaining -= ret.value();
+                    cb(ret);
+                },
+                m_stop_io);
+        }
+
+        // 分块编码的流式正文：读到的原始数据交给解析器解码，解码出的数据
+        // 放进 m_body_pending 再交给处理函数；格式错误或者超过上限时关闭连接
+        void do_read_chunked_body(bytes_view buf, callback<expected<size_t>> cb) {
+            if (m_req_parser.request_finished()) {
+                return io_context::get().complete(cb, 0);
+            }
+            m_reading = true;
+            m_last_active = io_context::get().coarse_now();
+            return m_conn.async_read(
+                m_readbuf,
+                [self = shared_from_this(), buf, cb = std::move(cb)](
+                    expected<size_t> ret) mutable {
+                    self->m_reading = false;
+                    if (!ret.error() && ret.value() == 0) {
+                        ret = -ECONNRESET;
+                    }
+                    if (ret.error()) {
+                        self->do_abort();
+                        return cb(ret);
+                    }
+                    auto data = self->m_readbuf.subspan(0, ret.value());
+                    size_t used = self->m_req_parser.push_chunk(data);
+                    self->m_pipelined.append(data.data() + used, data.size() - used);
+                    if (int status = self->_body_error()) {
+                        self->do_abort();
+                        return cb(status == 400 ? -EBADMSG : -EFBIG);
                     }
+                    self->m_body_pending = std::move(self->m_req_parser.body());
+                    return self->do_read_body(buf, std::move(cb));
                 },
-                stop_io);
+                m_stop_io);
+        }
+
+        // 连接出错，放弃当前请求并关闭连接：处理函数可能再也不会写响应
+        // （例如读取正文失败），m_resume 却持有连接自己的引用，不在这里扔掉
+        // 的话连接对象和它的 fd 永远不会释放；等着的回调也一起扔掉
+        // 只 shutdown 而不 close：可能还有操作挂在这个 fd 上，等最后一个
+        // 引用释放、连接回到对象池时再 close
+        void do_abort() {
+            m_request.m_resume = nullptr;
+            m_request.m_body_reader = nullptr;
+            m_after_flush = nullptr;
+            m_stop_io.request_stop();
+            if (m_conn.m_fd != -1) {
+                shutdown(m_conn.m_fd, SHUT_RDWR);
+            }
         }
 
         void do_handle() {
@@ -137,11 +852,15 @@ struct http_server : std::enable_shared_from_this<http_server> {
             m_request.method = m_req_parser.method();
             m_request.body = std::move(m_req_parser.body());
             m_request.con_type = m_req_parser.content_type();
+            m_request.headers = std::move(m_req_parser.headers());
             m_request.m_res_writer = &m_res_writer;
             m_request.m_resume = [self = shared_from_this()] {
-                self->do_write(self->m_res_writer.buffer());
+                self->do_respond();
             };
-            m_req_parser.reset_state();
+            m_request.m_flush = [this](callback<> cb) {
+                return do_write_partial(std::move(cb));
+            };
+            // 请求的 url、头部都指向解析器的缓冲区，响应写好后才重置解析器
 
             // fmt::println("我的响应头: {}", buffer);
             // fmt::println("我的响应正文: {}", body);
@@ -149,47 +868,236 @@ struct http_server : std::enable_shared_from_this<http_server> {
             m_router->do_handle(m_request);
         }
 
-        void do_write(bytes_const_view buffer) {
-            return m_conn.async_write(buffer, [self = shared_from_this(),
-                                               buffer](expected<size_t> ret) {
-                if (ret.error()) {
-                    // fmt::println("写入错误，放弃连接");
-                    return;
-                }
-                auto n = ret.value();
+        // 响应已经写好。流水线上还有后续请求时先不发送：复制到 m_output 排队，
+        // 接着处理下一个请求，需要等待或者攒够一批时再一起用一次 writev 发出
+        void do_respond() {
+            auto &writer = m_res_writer;
+            bool queue = !m_pipelined.empty() && m_batched + 1 < _max_batched &&
+                         m_request.m_file_body.m_fd == -1 &&
+                         !m_close_after_write && !_body_unread();
+            if (!queue) {
+                // 头部缓冲区在本次发送完成前不会变动，直接借用；正文的段转移过来
+                m_output.append_foreign(writer.buffer());
+                m_output.append(std::move(writer.body()));
+                return do_write();
+            }
+            // 写入器要留给下一个响应，头部复制一份
+            m_output.append(bytes_const_view(writer.buffer()));
+            m_output.append(std::move(writer.body()));
+            ++m_batched;
+            do_end_request();
+            return do_parse_pipelined();
+        }
 
-                if (buffer.size() == n) {
-                    self->m_res_writer.reset_state();
-                    return self->do_read();
-                }
-                return self->do_write(buffer.subspan(n));
-            });
+        // 分块响应的一部分：写好的头部、块发出去，但不结束当前请求；
+        // 写入器接着给下一块用，所以头部复制一份
+        void do_write_partial(callback<> cb) {
+            auto &writer = m_res_writer;
+            m_output.append(bytes_const_view(writer.buffer()));
+            m_output.append(std::move(writer.body()));
+            writer.reset_state();
+            return do_flush_then(std::move(cb));
+        }
+
+        // 当前请求的响应已经写出（或者排进了队列），为下一个请求重置
+        void do_end_request() {
+            m_res_writer.reset_state();
+            m_request.m_body_reader = nullptr;
+            m_body_chunked = false;
+            m_request.url = {};
+            m_request.con_type = {};
+            m_request.headers.clear();
+            m_req_parser.reset_state();
+        }
+
+        // 头部和正文的各个段用一次 writev 发出，部分写入由 async_writev 续写
+        void do_write() {
+            m_batched = 0;
+            m_iov.resize(m_output.segment_count());
+            m_output.fill_iovec(m_iov.data(), m_iov.size());
+            return m_conn.async_writev(
+                m_iov.data(), m_iov.size(),
+                [self = shared_from_this()](expected<size_t> ret) {
+                    if (ret.error()) {
+                        // fmt::println("写入错误，放弃连接");
+                        return self->do_abort();
+                    }
+                    self->m_output.clear();
+                    if (self->m_request.m_file_body.m_fd != -1) {
+                        return self->do_sendfile();
+                    }
+                    return self->do_finish_write();
+                });
+        }
+
+        void do_sendfile() {
+            return m_conn.async_sendfile(
+                m_request.m_file_body.m_fd, m_request.m_file_offset,
+                m_request.m_file_size,
+                [self = shared_from_this()](expected<size_t> ret) {
+                    if (ret.error()) {
+                        return self->do_abort();
+                    }
+                    return self->do_finish_write();
+                });
+        }
+
+        void do_finish_write() {
+            m_request.m_file_body = file_descriptor();
+            if (m_after_flush) {
+                return m_after_flush(); // 只是发出了排队的响应，当前请求还没处理完
+            }
+            // 正文没有读完的话，剩下的数据没法和下一个请求区分开，只能关闭
+            if (m_close_after_write || _body_unread()) {
+                return do_drain_and_close();
+            }
+            do_end_request();
+            return do_parse_pipelined();
+        }
+
+        // 接收缓冲区里还有没读的数据时 close，内核会发 RST，对方可能还没
+        // 读到响应（例如 413）就收到 ECONNRESET；所以先 shutdown(SHUT_WR)
+        // 发出 FIN，再读掉并丢弃对方继续发来的数据，直到对方关闭、
+        // 读够 _max_drain 字节或者超过 _drain_timeout，才真正关闭
+        void do_drain_and_close() {
+            shutdown(m_conn.m_fd, SHUT_WR);
+            m_drained = 0;
+            io_context::get().set_coarse_timeout(
+                _drain_timeout,
+                [weak = weak_from_this()] {
+                    if (auto self = weak.lock()) {
+                        self->m_stop_io.request_stop();
+                    }
+                },
+                m_idle_stop);
+            return do_drain();
+        }
+
+        void do_drain() {
+            return m_conn.async_read(
+                m_readbuf,
+                [self = shared_from_this()](expected<size_t> ret) {
+                    if (ret.error() || ret.value() == 0) {
+                        return;
+                    }
+                    self->m_drained += ret.value();
+                    if (self->m_drained >= _max_drain) {
+                        return;
+                    }
+                    return self->do_drain();
+                },
+                m_stop_io);
         }
     };
 
     async_file m_listening;
     address_resolver::address m_addr;
     http_router m_router;
+    stop_state m_stop; // accept 和所有连接共用，do_stop 时请求
+    static_file_cache m_static_cache;
+    timer_context::clock::duration m_idle_timeout = std::chrono::seconds(10);
+    http_compression_options m_compression;
 
     http_router &get_router() {
         return m_router;
     }
 
+    // 连接在等待下一个请求时最多空闲多久，超过则关闭；
+    // 为 0（或负数）时不限制，连接只在对方关闭或服务器停止时关闭
+    void set_idle_timeout(timer_context::clock::duration timeout) {
+        m_idle_timeout = timeout;
+    }
+
+    // 动态正文的压缩等级和最小长度；静态文件的压缩版本不受影响
+    void set_compression(http_compression_options options) {
+        m_compression = options;
+    }
+
     void do_start(std::string name, std::string port) {
         address_resolver resolver;
         auto entry = resolver.resolve(name, port);
+        // 对方提前关闭连接时 writev/sendfile 返回 EPIPE 即可，不要整个进程被信号杀掉
+        signal(SIGPIPE, SIG_IGN);
         m_listening = async_file::async_bind(entry);
         return do_accept();
     }
 
+    // 停止接受新连接，释放挂在监听 socket 上的 accept，
+    // 并取消所有连接正在进行的读写，空闲的长连接随之关闭
+    void do_stop() {
+        m_stop.request_stop();
+        m_static_cache.stop();
+    }
+
+    // 本线程连接对象池的命中情况
+    static pool_stats connection_pool_stats() {
+        return object_pool<http_connection_handler>::get().stats();
+    }
+
+    // accept 失败大多是暂时的，监听 socket 本身没有问题：fd 或内存用完时
+    // 等一会儿再接受（其间新连接留在 backlog 里），对方在 accept 之前就
+    // 断开等网络错误直接重试；只有其他错误才抛出
+    static constexpr auto _accept_backoff = std::chrono::milliseconds(100);
+    bool m_accept_failing = false; // 连续失败时只报告第一次
+
+    static bool _accept_needs_backoff(int err) noexcept {
+        return err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM;
+    }
+
+    // 见 accept(2)：这些错误应当像 EAGAIN 一样重试
+    static bool _accept_retryable(int err) noexcept {
+        switch (err) {
+        case ECONNABORTED: case EINTR: case EPROTO: case EPERM:
+        case ENETDOWN: case ENOPROTOOPT: case EHOSTDOWN: case ENONET:
+        case EHOSTUNREACH: case EOPNOTSUPP: case ENETUNREACH:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void do_accept_error(expected<int> ret) {
+        int err = -ret.error();
+        bool backoff = _accept_needs_backoff(err);
+        if (!backoff && !_accept_retryable(err)) {
+            (void)ret.expect("accept");
+        }
+        if (!m_accept_failing) {
+            std::fprintf(stderr, "accept: %s%s\n", std::strerror(err),
+                         backoff ? "，稍后重试" : "");
+        }
+        m_accept_failing = true;
+        if (!backoff) {
+            return do_accept();
+        }
+        io_context::get().set_timeout(
+            _accept_backoff,
+            [self = shared_from_this()] {
+                if (self->m_stop.stop_requested()) {
+                    return; // 定时器被 do_stop 提前触发
+                }
+                return self->do_accept();
+            },
+            m_stop);
+    }
+
     void do_accept() {
         return m_listening.async_accept(m_addr, [self = shared_from_this()](
                                                     expected<int> ret) {
-            auto connfd = ret.expect("accept");
+            if (ret.is_error(ECANCELED)) {
+                return;
+            }
+            if (ret.error()) {
+                return self->do_accept_error(ret);
+            }
+            self->m_accept_failing = false;
+            int connfd = ret.value();
 
             // fmt::println("接受了一个连接: {}", connfd);
-            http_connection_handler::make()->do_start(&self->m_router, connfd);
+            http_connection_handler::make()->do_start(
+                &self->m_router, &self->m_static_cache, &self->m_compression,
+                connfd, self->m_idle_timeout, self->m_stop);
             return self->do_accept();
-        });
+        }, m_stop);
     }
 };
\ No newline at end of file
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "io_context.hpp"
+#include "http_server.hpp"
+
+// 多线程模式：每个线程一个 io_context，各自 bind 同一端口（SO_REUSEPORT），
+// 由内核在多个监听 socket 之间分发连接，线程之间不共享任何状态
+struct http_server_pool {
+    using setup_function = std::function<void(http_server::http_router &)>;
+
+    std::vector<std::thread> m_threads;
+    std::vector<io_context *> m_contexts; // 已退出的线程对应 nullptr
+    std::mutex m_mutex;
+    std::condition_variable m_ready_cv;
+    size_t m_ready_count = 0;
+    bool m_stopping = false;
+    std::exception_ptr m_error;
+    pool_stats m_conn_stats; // 已退出线程的连接对象池统计之和
+    http_compression_options m_compression;
+    timer_context::clock::duration m_idle_timeout = std::chrono::seconds(10);
+
+    http_server_pool() = default;
+    http_server_pool(http_server_pool &&) = delete;
+
+    ~http_server_pool() {
+        stop();
+        join();
+    }
+
+    static size_t default_concurrency() noexcept {
+        size_t n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    // 在 do_start 之前调用，对每个线程的 http_server 生效
+    void set_compression(http_compression_options options) {
+        m_compression = options;
+    }
+
+    // 同上：连接在等待下一个请求时最多空闲多久，为 0 时不限制
+    void set_idle_timeout(timer_context::clock::duration timeout) {
+        m_idle_timeout = timeout;
+    }
+
+    // setup 会在每个线程里各调用一次，为该线程的 http_server
+    // 注册一份独立的路由（路由回调不可复制，所以每个线程重新构建）
+    void do_start(std::string name, std::string port, setup_function setup,
+                  size_t nthreads = default_concurrency()) {
+        assert(m_threads.empty());
+        m_contexts.assign(nthreads, nullptr);
+        for (size_t i = 0; i < nthreads; ++i) {
+            m_threads.emplace_back(&http_server_pool::_thread_main, this, i,
+                                   name, port, setup);
+        }
+
+        // 等待所有线程都开始监听，或者有线程启动失败
+        std::unique_lock lock(m_mutex);
+        m_ready_cv.wait(lock, [&] {
+            return m_ready_count == nthreads || m_error;
+        });
+        if (m_error) {
+            lock.unlock();
+            stop();
+            join();
+            std::rethrow_exception(m_error);
+        }
+    }
+
+    void _thread_main(size_t index, std::string name, std::string port,
+                      setup_function setup) {
+        io_context ctx;
+        bool started = false;
+        try {
+            auto server = http_server::make();
+            setup(server->get_router());
+            server->set_compression(m_compression);
+            server->set_idle_timeout(m_idle_timeout);
+            server->do_start(name, port);
+            {
+                std::lock_guard lock(m_mutex);
+                m_contexts[index] = &ctx;
+                ++m_ready_count;
+                started = true;
+                if (m_stopping) {
+                    ctx.stop(); // stop() 先于本线程就绪调用
+                }
+            }
+            m_ready_cv.notify_all();
+
+            ctx.join();
+            server->do_stop();
+            std::lock_guard lock(m_mutex);
+            m_conn_stats += http_server::connection_pool_stats();
+        } catch (...) {
+            std::lock_guard lock(m_mutex);
+            if (!started && !m_error) {
+                m_error = std::current_exception();
+            }
+            m_ready_cv.notify_all();
+            if (started) {
+                // 启动之后不会再有人 rethrow，只能报告出来；
+                // 本线程的监听 socket 随之关闭，其他线程照常服务
+                _report_error(index, std::current_exception());
+            }
+        }
+        std::lock_guard lock(m_mutex);
+        m_contexts[index] = nullptr; // ctx 即将析构，不能再被 stop() 访问
+    }
+
+    static void _report_error(size_t index, std::exception_ptr error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (std::exception const &e) {
+            std::fprintf(stderr, "http_server_pool: 线程 %zu 退出：%s\n", index,
+                         e.what());
+        } catch (...) {
+            std::fprintf(stderr, "http_server_pool: 线程 %zu 退出\n", index);
+        }
+    }
+
+    // 线程安全：通知所有 io_context 退出 join()，不再接受新连接
+    void stop() {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+        for (io_context *ctx: m_contexts) {
+            if (ctx) {
+                ctx->stop();
+            }
+        }
+    }
+
+    void join() {
+        for (auto &thread: m_threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+        m_threads.clear();
+    }
+
+    // join() 之后调用，得到所有线程的汇总
+    pool_stats connection_pool_stats() {
+        std::lock_guard lock(m_mutex);
+        return m_conn_stats;
+    }
+
+    size_t size() const noexcept {
+        return m_contexts.size();
+    }
+};
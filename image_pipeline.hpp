@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cerrno>
+#include <string>
+#include <vector>
+#include "callback.hpp"
+#include "expected.hpp"
+#include "io_context.hpp"
+#include "upload_store.hpp"
+#include "worker_pool.hpp"
+#include "opencv2/opencv.hpp"
+
+// 上传图片的处理：把上传存储中的原文件解码后重新编码成 PNG，
+// 作为它的 "png" 编码保存在原文件旁边，同样内容的图片只编码一次
+// 解码、编码都很耗 CPU，放在专用的线程池里做，不占用事件循环
+// 排队的任务有上限，满了直接拒绝（调用者回复 503），不让积压无限增长
+// 编码结果由条目分发给所有等待者，各自 post 回自己的 io_context
+struct image_pipeline {
+    worker_pool m_pool;
+
+    explicit image_pipeline(size_t nthreads = 2, size_t max_queued = 16)
+        : m_pool(nthreads, max_queued) {}
+
+    // 进程内共用一个，所有线程的 io_context 都往这里提交
+    static image_pipeline &get() {
+        static image_pipeline instance;
+        return instance;
+    }
+
+    // 只能在循环线程调用：生成（或者取得已有的）entry 的 PNG 编码，
+    // 完成后在当前 io_context 上调用 done，值为 PNG 文件的描述符，
+    // 无法解码时为 -EINVAL，队列已满、没能提交编码任务时为 -EBUSY
+    // 已经编码过的不再进入线程池；正在编码的（例如同一张图片被同时上传）
+    // 等那一次编码完成，不会重复编码
+    void try_make_png(upload_store &store, upload_store::entry_pointer entry,
+                      callback<expected<int>> done) {
+        // 只试一次锁，拿不到就当作还没有，由 begin_variant 决定
+        if (auto fd = entry->variant_fd("png"); !fd.error()) {
+            return io_context::get().complete(done, fd);
+        }
+        // 条目要活到 done 用完它的文件描述符
+        callback<expected<int>> waiter = _post_back(entry, std::move(done));
+        auto ret = entry->begin_variant("png", waiter);
+        if (!ret.error()) {
+            return waiter(ret); // 刚刚有人生成完
+        }
+        if (ret.is_error(EINPROGRESS)) {
+            return;
+        }
+        callback<> task = [&store, entry] {
+            store.make_variant(*entry, "png", _encode_png);
+        };
+        if (!m_pool.try_submit(task)) {
+            entry->finish_variant("png", -EBUSY);
+        }
+    }
+
+    // 包装 done：可以在任何线程调用，结果 post 回当前 io_context 再交给 done
+    static callback<expected<int>> _post_back(upload_store::entry_pointer entry,
+                                              callback<expected<int>> done) {
+        io_context &ctx = io_context::get();
+        ctx.work_started();
+        return [&ctx, entry = std::move(entry),
+                done = std::move(done)](expected<int> ret) mutable {
+            ctx.post([&ctx, entry = std::move(entry), done = std::move(done),
+                      ret]() mutable {
+                ctx.work_finished();
+                done(ret);
+            });
+        };
+    }
+
+    // 在工作线程执行
+    static expected<int> _encode_png(std::string const &original,
+                                     std::string &png) {
+        std::vector<char> data(original.begin(), original.end());
+        cv::Mat img = cv::imdecode(data, cv::IMREAD_COLOR);
+        if (img.empty()) {
+            return -EINVAL;
+        }
+        std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION, 1};
+        std::vector<unsigned char> buf;
+        if (!cv::imencode(".png", img, buf, params)) {
+            return -EINVAL;
+        }
+        png.assign(buf.begin(), buf.end());
+        return 0;
+    }
+};
@@ -3,6 +3,10 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
@@ -11,24 +15,270 @@
 #include "timer_context.hpp"
 #include "bytes_buffer.hpp"
 #include "expected.hpp"
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstring>
 #include <array>
+#include <atomic>
+#include <memory>
+#if USE_IO_URING
+#include "io_uring_queue.hpp"
+#endif
+
+// 每个 fd 在 epoll 里常驻的状态：只以边沿触发注册一次，之后靠就绪标志
+// 和读、写两个独立的等待槽位恢复对应的等待者，不再需要 EPOLL_CTL_MOD
+struct epoll_fd_state {
+    callback<> m_read_waiter;
+    callback<> m_write_waiter;
+    stop_callback m_read_stop_cb;
+    stop_callback m_write_stop_cb;
+    bool m_readable = true; // 上次读到 EAGAIN 后为 false，直到 epoll 通知
+    bool m_writable = true;
+    bool m_registered = false; // io_uring 后端下推迟到第一次等待就绪时才注册
+
+    callback<> _take_read_waiter() noexcept {
+        m_read_stop_cb.reset();
+        return std::move(m_read_waiter);
+    }
+
+    callback<> _take_write_waiter() noexcept {
+        m_write_stop_cb.reset();
+        return std::move(m_write_waiter);
+    }
+};
 
 struct io_context : timer_context {
     int m_epfd;
+    int m_wakefd; // 用于从其他线程唤醒 epoll_pwait 的 eventfd
     size_t m_epcount = 0;
+    std::atomic<bool> m_stop_requested{false};
+
+    // 其他线程投递过来的任务：无锁的 MPSC 栈，循环线程一次性整批取走
+    struct _post_node {
+        _post_node *m_next;
+        callback<> m_cb;
+    };
+    std::atomic<_post_node *> m_post_head{nullptr};
+    size_t m_work_count = 0; // 在别处进行、完成后会 post 回来的工作数
+
+    // 同步完成的回调层层嵌套（例如对方一次发来很多数据，每次 read 都立即成功）
+    // 超过一定深度后推迟到下一轮循环再调用，避免栈溢出
+    static constexpr size_t _max_sync_depth = 32;
+    size_t m_sync_depth = 0;
+    _post_node *m_deferred_head = nullptr;
+    _post_node *m_deferred_tail = nullptr;
+#if USE_IO_URING
+    // 一个已提交的 io_uring 操作，地址作为 user_data 交给内核
+    struct _uring_op {
+        callback<int> m_cb;
+        stop_callback m_stop_cb; // 请求停止时提交 ASYNC_CANCEL
+        _uring_op *m_next = nullptr;
+    };
+
+    io_uring_queue m_uring;
+    bool m_uring_enabled = false; // 运行时检测，内核不支持时退回 epoll
+    size_t m_uring_count = 0;     // 已提交、尚未完成的 io_uring 操作数
+    _uring_op *m_uring_free = nullptr;
+    // 本轮完成的操作：可能还有指向它的 ASYNC_CANCEL 排在提交队列里，
+    // 要等这些 SQE 提交之后才能复用，否则会取消掉复用后的新操作
+    _uring_op *m_uring_retired = nullptr;
+#endif
 
     static inline thread_local io_context *g_instance = nullptr;
 
     io_context()
-        : m_epfd(convert_error(epoll_create1(0)).expect("epoll_create")) {
+        : m_epfd(convert_error(epoll_create1(EPOLL_CLOEXEC))
+                     .expect("epoll_create")),
+          m_wakefd(convert_error(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+                       .expect("eventfd")) {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = &m_wakefd; // 唤醒事件的标记，不是回调
+        convert_error(epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakefd, &event))
+            .expect("EPOLL_CTL_ADD");
+#if USE_IO_URING
+        m_uring_enabled = m_uring.init(256);
+#endif
         g_instance = this;
     }
 
+    io_context(io_context &&) = delete;
+
+    // 可以在任何线程调用：把任务交给本循环执行
+    void post(callback<> cb) {
+        auto *node = new _post_node{nullptr, std::move(cb)};
+        _post_node *head = m_post_head.load(std::memory_order_relaxed);
+        do {
+            node->m_next = head;
+        } while (!m_post_head.compare_exchange_weak(
+            head, node, std::memory_order_release, std::memory_order_relaxed));
+        // 队列原本为空时才需要唤醒，否则循环稍后取走时自然会看到这个任务
+        if (head == nullptr) {
+            _wakeup();
+        }
+    }
+
+    // 只能在循环线程调用：有工作交给了其他线程，完成前 join() 不能退出，
+    // 完成后在 post 回来的任务里调用 work_finished()
+    void work_started() noexcept {
+        ++m_work_count;
+    }
+
+    void work_finished() noexcept {
+        assert(m_work_count > 0);
+        --m_work_count;
+    }
+
+    // 只能在循环线程调用：下一轮循环时执行 cb
+    void defer(callback<> cb) {
+        auto *node = new _post_node{nullptr, std::move(cb)};
+        if (m_deferred_tail) {
+            m_deferred_tail->m_next = node;
+        } else {
+            m_deferred_head = node;
+        }
+        m_deferred_tail = node;
+    }
+
+    void _run_deferred() {
+        _post_node *head = std::exchange(m_deferred_head, nullptr);
+        m_deferred_tail = nullptr;
+        while (head) {
+            std::unique_ptr<_post_node> node(head);
+            head = head->m_next;
+            node->m_cb();
+        }
+    }
+
+    // 调用一个可能是同步完成的回调：嵌套太深时改为 defer
+    template <class T, class U>
+    void complete(callback<T> &cb, U &&u) {
+        T value(std::forward<U>(u));
+        if (m_sync_depth >= _max_sync_depth) {
+            return defer([cb = std::move(cb), value]() mutable {
+                cb(value);
+            });
+        }
+        struct depth_guard {
+            size_t &m_depth;
+
+            ~depth_guard() {
+                --m_depth;
+            }
+        } guard{++m_sync_depth};
+        cb(value);
+    }
+
+    void _run_posted() {
+        _post_node *head = m_post_head.exchange(nullptr, std::memory_order_acquire);
+        // 栈是后进先出，反转成投递的顺序再执行
+        _post_node *prev = nullptr;
+        while (head) {
+            _post_node *next = head->m_next;
+            head->m_next = prev;
+            prev = head;
+            head = next;
+        }
+        while (prev) {
+            std::unique_ptr<_post_node> node(prev);
+            prev = prev->m_next;
+            node->m_cb();
+        }
+    }
+
+    // 可以在任何线程调用：请求 join() 尽快返回
+    void stop() noexcept {
+        m_stop_requested.store(true, std::memory_order_release);
+        _wakeup();
+    }
+
+    bool stop_requested() const noexcept {
+        return m_stop_requested.load(std::memory_order_acquire);
+    }
+
+    void _wakeup() noexcept {
+        uint64_t one = 1;
+        (void)!write(m_wakefd, &one, sizeof(one));
+    }
+
+    void _drain_wakeup() noexcept {
+        uint64_t count;
+        (void)!read(m_wakefd, &count, sizeof(count));
+    }
+
+    void _dispatch_epoll_events(struct epoll_event *events, int n) {
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == &m_wakefd) {
+                _drain_wakeup();
+                _run_posted();
+                continue;
+            }
+            auto *state = static_cast<epoll_fd_state *>(events[i].data.ptr);
+            uint32_t ev = events[i].events;
+            // 先把两个等待者都取出来，因为恢复读等待者时可能会析构该 fd
+            callback<> read_cb, write_cb;
+            if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                state->m_readable = true;
+                read_cb = state->_take_read_waiter();
+            }
+            if (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                state->m_writable = true;
+                write_cb = state->_take_write_waiter();
+            }
+            if (read_cb) {
+                --m_epcount;
+                read_cb();
+            }
+            if (write_cb) {
+                --m_epcount;
+                write_cb();
+            }
+        }
+    }
+
+    // stop() 之后 join() 不再处理 I/O 和定时器，但交给其他线程的工作
+    // （work_started）还是要等它们 post 回来、执行完才返回，否则 io_context
+    // 析构之后工作线程会向已经释放的循环投递任务
     void join() {
+        _join_loop();
+        _join_work();
+    }
+
+    // 只等待 post 回来的任务，回调里新交出去的工作也一起等；
+    // 回调里发起的 I/O 不会再被处理，随 io_context 析构丢弃
+    void _join_work() {
+        while (true) {
+            _run_deferred();
+            if (m_work_count == 0) {
+                return;
+            }
+            struct pollfd pfd = {m_wakefd, POLLIN, 0};
+            auto ret = convert_error(poll(&pfd, 1, -1));
+            if (!ret.is_error(EINTR)) {
+                ret.expect("poll");
+            }
+            _drain_wakeup();
+            _run_posted();
+        }
+    }
+
+    void _join_loop() {
+#if USE_IO_URING
+        if (m_uring_enabled) {
+            return _join_uring();
+        }
+#endif
         std::array<struct epoll_event, 128> events;
-        while (!is_empty()) {
+        while (!is_empty() && !stop_requested()) {
+            _run_deferred();
             std::chrono::nanoseconds dt = duration_to_next_timer();
+            if (is_empty()) {
+                break; // 最后的工作是刚刚触发的定时器，不能再无限期等待
+            }
+            if (m_deferred_head) {
+                dt = std::chrono::nanoseconds(0); // 还有推迟的回调，不能阻塞
+            }
 #if HAS_epoll_pwait2
             struct timespec timeout, *timeoutp = nullptr;
             if (dt.count() >= 0) {
@@ -43,22 +293,165 @@ struct io_context : timer_context {
 #else
             int timeout_ms = -1;
             if (dt.count() >= 0) {
-                timeout_ms = dt.count() / 1'000'000;
+                timeout_ms = (dt.count() + 999'999) / 1'000'000;
             }
             int ret =
                 convert_error(epoll_pwait(m_epfd, events.data(), events.size(),
                                            timeout_ms, nullptr))
                     .expect("epoll_pwait");
 #endif
-            for (int i = 0; i < ret; ++i) {
-                auto cb = callback<>::from_address(events[i].data.ptr);
-                cb();
-                --m_epcount;
+            _update_now();
+            _dispatch_epoll_events(events.data(), ret);
+        }
+    }
+
+#if USE_IO_URING
+    // epoll 本身也作为一个 fd 挂到 io_uring 上，这样不走 io_uring 的操作
+    // （唤醒用的 eventfd、EAGAIN 回退等）依然由同一个循环处理
+    void _uring_poll_epoll() {
+        struct io_uring_sqe *sqe = m_uring.get_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_epfd;
+        sqe->poll32_events = EPOLLIN;
+        sqe->user_data = reinterpret_cast<uintptr_t>(&m_epfd);
+    }
+
+    // 取消一个已提交的操作，该操作随后以 -ECANCELED 完成
+    void _uring_cancel(void *user_data) {
+        struct io_uring_sqe *sqe = m_uring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = reinterpret_cast<uintptr_t>(user_data);
+        sqe->user_data = 0;
+    }
+
+    void _uring_submit(struct io_uring_sqe *sqe, callback<int> cb,
+                       stop_source stop) {
+        _uring_op *op = m_uring_free;
+        if (op) {
+            m_uring_free = op->m_next;
+        } else {
+            op = new _uring_op;
+        }
+        op->m_cb = std::move(cb);
+        sqe->user_data = reinterpret_cast<uintptr_t>(op);
+        ++m_uring_count;
+        stop.add_stop_callback(op->m_stop_cb, [this, op] {
+            _uring_cancel(op);
+        });
+    }
+
+    void _uring_complete(uint64_t user_data, int res) {
+        auto *op = reinterpret_cast<_uring_op *>(user_data);
+        op->m_stop_cb.reset();
+        auto cb = std::move(op->m_cb);
+        op->m_next = m_uring_retired;
+        m_uring_retired = op;
+        --m_uring_count;
+        cb(res);
+    }
+
+    void _uring_recycle() noexcept {
+        while (m_uring_retired) {
+            _uring_op *op = m_uring_retired;
+            m_uring_retired = op->m_next;
+            op->m_next = m_uring_free;
+            m_uring_free = op;
+        }
+    }
+
+    static void _uring_delete_list(_uring_op *op) noexcept {
+        while (op) {
+            delete std::exchange(op, op->m_next);
+        }
+    }
+
+#ifdef IORING_ASYNC_CANCEL_ANY
+    // 循环结束后还在内核里的操作：全部取消，丢弃（不调用）它们的回调，
+    // 释放回调捕获的连接等资源
+    void _uring_shutdown() {
+        struct io_uring_sqe *sqe = m_uring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        sqe->fd = -1;
+        sqe->user_data = 0;
+        struct __kernel_timespec timeout = {0, 100'000'000};
+        bool progress = true;
+        while (m_uring_count != 0 && progress) {
+            progress = false;
+            m_uring.submit_and_wait(1, &timeout);
+            m_uring.for_each_cqe([&](uint64_t user_data, int) {
+                progress = true;
+                if (user_data == 0 ||
+                    user_data == reinterpret_cast<uintptr_t>(&m_epfd)) {
+                    return;
+                }
+                --m_uring_count;
+                auto *op = reinterpret_cast<_uring_op *>(user_data);
+                op->m_stop_cb.reset();
+                op->m_cb = nullptr; // 只析构，不调用
+                op->m_next = m_uring_free;
+                m_uring_free = op;
+            });
+        }
+    }
+#else
+    void _uring_shutdown() {}
+#endif
+
+    void _join_uring() {
+        _uring_poll_epoll();
+        while (!is_empty() && !stop_requested()) {
+            _run_deferred();
+            std::chrono::nanoseconds dt = duration_to_next_timer();
+            if (is_empty()) {
+                break; // 最后的工作是刚刚触发的定时器，不能再无限期等待
+            }
+            if (m_deferred_head) {
+                dt = std::chrono::nanoseconds(0); // 还有推迟的回调，不能阻塞
+            }
+            struct __kernel_timespec timeout, *timeoutp = nullptr;
+            if (dt.count() >= 0) {
+                timeout.tv_sec = dt.count() / 1'000'000'000;
+                timeout.tv_nsec = dt.count() % 1'000'000'000;
+                timeoutp = &timeout;
             }
+            // 本轮积攒的所有 SQE 在这里一次性提交
+            m_uring.submit_and_wait(1, timeoutp);
+            _uring_recycle();
+            _update_now();
+            m_uring.for_each_cqe([this](uint64_t user_data, int res) {
+                if (user_data == 0) {
+                    return;
+                }
+                if (user_data == reinterpret_cast<uintptr_t>(&m_epfd)) {
+                    std::array<struct epoll_event, 128> events;
+                    int ret = convert_error(epoll_wait(m_epfd, events.data(),
+                                                       events.size(), 0))
+                                  .expect("epoll_wait");
+                    _dispatch_epoll_events(events.data(), ret);
+                    return _uring_poll_epoll();
+                }
+                _uring_complete(user_data, res);
+            });
         }
     }
+#endif
 
     ~io_context() {
+#if USE_IO_URING
+        if (m_uring_enabled) {
+            _uring_shutdown();
+        }
+        _uring_delete_list(m_uring_free);
+        _uring_delete_list(m_uring_retired);
+#endif
+        for (_post_node *head: {m_post_head.exchange(nullptr), m_deferred_head}) {
+            while (head) {
+                std::unique_ptr<_post_node> node(head);
+                head = head->m_next;
+            }
+        }
+        close(m_wakefd);
         close(m_epfd);
         g_instance = nullptr;
     }
@@ -69,7 +462,14 @@ struct io_context : timer_context {
     }
 
     bool is_empty() const {
-        return timer_context::is_empty() && m_epcount == 0;
+#if USE_IO_URING
+        if (m_uring_count != 0) {
+            return false;
+        }
+#endif
+        return timer_context::is_empty() && m_epcount == 0 &&
+               m_work_count == 0 && m_deferred_head == nullptr &&
+               m_post_head.load(std::memory_order_acquire) == nullptr;
     }
 };
 
@@ -177,156 +577,417 @@ struct address_resolver {
 };
 
 struct async_file : file_descriptor {
+    // 放在堆上，async_file 移动后 epoll 里登记的 data.ptr 依然有效
+    std::unique_ptr<epoll_fd_state> m_state;
+
     async_file() = default;
 
-    explicit async_file(int fd) : file_descriptor(fd) {
+    explicit async_file(int fd)
+        : file_descriptor(fd), m_state(std::make_unique<epoll_fd_state>()) {
         int flags = convert_error(fcntl(m_fd, F_GETFL)).expect("F_GETFL");
         flags |= O_NONBLOCK;
         convert_error(fcntl(m_fd, F_SETFL, flags)).expect("F_SETFL");
 
+#if USE_IO_URING
+        // 读写都交给 io_uring 时用不到 epoll，省掉每个连接一次 epoll_ctl
+        if (io_context::get().m_uring_enabled) {
+            return;
+        }
+#endif
+        _epoll_register();
+    }
+
+    void _epoll_register() {
+        if (m_state->m_registered) {
+            return;
+        }
         struct epoll_event event;
-        event.events = EPOLLET;
-        event.data.ptr = nullptr;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = m_state.get();
         convert_error(
             epoll_ctl(io_context::get().m_epfd, EPOLL_CTL_ADD, m_fd, &event))
             .expect("EPOLL_CTL_ADD");
+        m_state->m_registered = true;
     }
 
-    void _epoll_callback(callback<> &&resume, uint32_t events,
-                         stop_source stop) {
-        struct epoll_event event;
-        event.events = events;
-        event.data.ptr = resume.get_address();
-        convert_error(
-            epoll_ctl(io_context::get().m_epfd, EPOLL_CTL_MOD, m_fd, &event))
-            .expect("EPOLL_CTL_MOD");
+    // 挂到读或写的等待槽位上，直到 epoll 通知就绪，或者 stop 被请求
+    // 边沿触发下 EPOLL_CTL_ADD 时已经就绪的 fd 也会报告一次，
+    // 所以在 EAGAIN 之后才注册不会丢失通知
+    void _epoll_wait_readable(callback<> &&resume, stop_source stop) {
+        _epoll_register();
+        assert(!m_state->m_read_waiter);
+        m_state->m_readable = false;
+        m_state->m_read_waiter = std::move(resume);
         ++io_context::get().m_epcount;
-        stop.set_stop_callback([resume_ptr = resume.leak_address()] {
-            callback<>::from_address(resume_ptr)();
+        stop.add_stop_callback(m_state->m_read_stop_cb, [state = m_state.get()] {
+            auto cb = state->_take_read_waiter();
+            --io_context::get().m_epcount;
+            cb();
         });
     }
 
-    void async_read(bytes_view buf, callback<expected<size_t>> cb,
-                    stop_source stop = {}) {
-#if USE_LEVEL_TRIGGER
-        // 如果 read 可以读了，请操作系统，调用，我这个回调
-        return _epoll_callback(
-            [this, buf, cb = std::move(cb), stop]() mutable {
-                if (stop.stop_requested()) {
-                    stop.clear_stop_callback();
-                    return cb(-ECANCELED);
+    void _epoll_wait_writable(callback<> &&resume, stop_source stop) {
+        _epoll_register();
+        assert(!m_state->m_write_waiter);
+        m_state->m_writable = false;
+        m_state->m_write_waiter = std::move(resume);
+        ++io_context::get().m_epcount;
+        stop.add_stop_callback(m_state->m_write_stop_cb, [state = m_state.get()] {
+            auto cb = state->_take_write_waiter();
+            --io_context::get().m_epcount;
+            cb();
+        });
+    }
+
+#if USE_IO_URING
+    // 提交一个 io_uring 操作，完成时以原始的 res（负数为 -errno）回调
+    void _uring_callback(struct io_uring_sqe *sqe, callback<int> &&resume,
+                         stop_source stop) {
+        io_context::get()._uring_submit(sqe, std::move(resume), stop);
+    }
+
+    void _uring_read(bytes_view buf, callback<expected<size_t>> cb,
+                     stop_source stop) {
+        auto *sqe = io_context::get().m_uring.get_sqe();
+        io_uring_queue::prep_rw(sqe, IORING_OP_READ, m_fd, buf.data(),
+                                buf.size(), static_cast<uint64_t>(-1));
+        return _uring_callback(
+            sqe,
+            [this, buf, cb = std::move(cb), stop](int res) mutable {
+                if (res == -EAGAIN) { // 老内核对非阻塞 fd 不会自动等待
+                    return _epoll_read(buf, std::move(cb), stop);
                 }
-                auto ret = convert_error<size_t>(read(m_fd, buf.data(), buf.size()));
-                stop.clear_stop_callback();
-                return cb(ret);
+                return cb(res);
             },
-            EPOLLIN | EPOLLERR | EPOLLONESHOT, stop);
-#else
+            stop);
+    }
+
+    void _uring_write(bytes_const_view buf, callback<expected<size_t>> cb,
+                      stop_source stop) {
+        auto *sqe = io_context::get().m_uring.get_sqe();
+        io_uring_queue::prep_rw(sqe, IORING_OP_WRITE, m_fd, buf.data(),
+                                buf.size(), static_cast<uint64_t>(-1));
+        return _uring_callback(
+            sqe,
+            [this, buf, cb = std::move(cb), stop](int res) mutable {
+                if (res == -EAGAIN) {
+                    return _epoll_write(buf, std::move(cb), stop);
+                }
+                return cb(res);
+            },
+            stop);
+    }
+
+    void _uring_writev(struct iovec *iov, size_t iovcnt, size_t written,
+                       callback<expected<size_t>> cb, stop_source stop) {
+        auto *sqe = io_context::get().m_uring.get_sqe();
+        io_uring_queue::prep_rw(sqe, IORING_OP_WRITEV, m_fd, iov,
+                                std::min<size_t>(iovcnt, IOV_MAX),
+                                static_cast<uint64_t>(-1));
+        return _uring_callback(
+            sqe,
+            [this, iov, iovcnt, written, cb = std::move(cb),
+             stop](int res) mutable {
+                if (res == -EAGAIN) {
+                    return _epoll_writev(iov, iovcnt, written, std::move(cb),
+                                         stop);
+                }
+                if (res < 0) {
+                    return cb(res);
+                }
+                written += res;
+                _advance_iovec(iov, iovcnt, res);
+                if (iovcnt == 0) {
+                    return cb(written);
+                }
+                return _uring_writev(iov, iovcnt, written, std::move(cb), stop);
+            },
+            stop);
+    }
+
+    void _uring_accept(address_resolver::address &addr,
+                       callback<expected<int>> cb, stop_source stop) {
+        addr.m_addrlen = sizeof(addr.m_addr_storage);
+        auto *sqe = io_context::get().m_uring.get_sqe();
+        io_uring_queue::prep_rw(sqe, IORING_OP_ACCEPT, m_fd, &addr.m_addr, 0,
+                                reinterpret_cast<uintptr_t>(&addr.m_addrlen));
+        return _uring_callback(
+            sqe,
+            [this, &addr, cb = std::move(cb), stop](int res) mutable {
+                if (res == -EAGAIN) {
+                    return _epoll_accept(addr, std::move(cb), stop);
+                }
+                return cb(res);
+            },
+            stop);
+    }
+
+    void _uring_connect(address_resolver::address_info const &addr,
+                        callback<expected<int>> cb, stop_source stop) {
+        // 地址要一直有效到内核真正处理这个 SQE，所以复制一份跟随回调
+        auto addr_ptr = addr.get_address();
+        auto saved = std::make_unique<address_resolver::address>();
+        std::memcpy(&saved->m_addr_storage, addr_ptr.m_addr, addr_ptr.m_addrlen);
+        saved->m_addrlen = addr_ptr.m_addrlen;
+        auto *sqe = io_context::get().m_uring.get_sqe();
+        io_uring_queue::prep_rw(sqe, IORING_OP_CONNECT, m_fd, &saved->m_addr, 0,
+                                saved->m_addrlen);
+        return _uring_callback(
+            sqe,
+            [saved = std::move(saved), cb = std::move(cb), stop](int res) mutable {
+                return cb(res);
+            },
+            stop);
+    }
+#endif
+
+    void async_read(bytes_view buf, callback<expected<size_t>> cb,
+                    stop_source stop = {}) {
         if (stop.stop_requested()) {
-            stop.clear_stop_callback();
             return cb(-ECANCELED);
         }
-        auto ret = convert_error<size_t>(read(m_fd, buf.data(), buf.size()));
-        if (!ret.is_error(EAGAIN)) {
-            stop.clear_stop_callback();
-            return cb(ret);
+#if USE_IO_URING
+        if (io_context::get().m_uring_enabled) {
+            return _uring_read(buf, std::move(cb), stop);
         }
-
-        // 如果 read 可以读了，请操作系统，调用，我这个回调
-        return _epoll_callback(
-            [this, buf, cb = std::move(cb), stop]() mutable {
-                return async_read(buf, std::move(cb), stop);
-            },
-            EPOLLIN | EPOLLERR | EPOLLET | EPOLLONESHOT, stop);
 #endif
+        return _epoll_read(buf, std::move(cb), stop);
     }
 
     void async_write(bytes_const_view buf, callback<expected<size_t>> cb,
                      stop_source stop = {}) {
-#if USE_LEVEL_TRIGGER
-        // 如果 write 可以写了，请操作系统，调用，我这个回调
-        return _epoll_callback(
+        if (stop.stop_requested()) {
+            return cb(-ECANCELED);
+        }
+#if USE_IO_URING
+        if (io_context::get().m_uring_enabled) {
+            return _uring_write(buf, std::move(cb), stop);
+        }
+#endif
+        return _epoll_write(buf, std::move(cb), stop);
+    }
+
+    // 一次系统调用写出多个缓冲区，部分写入时自动从断点继续，
+    // 全部写完才以总字节数回调
+    // 注意：iov 数组在完成前必须保持有效，并且会被就地修改（跳过已写出的部分）
+    void async_writev(struct iovec *iov, size_t iovcnt,
+                      callback<expected<size_t>> cb, stop_source stop = {}) {
+        if (stop.stop_requested()) {
+            return cb(-ECANCELED);
+        }
+        _skip_empty_iovec(iov, iovcnt);
+        if (iovcnt == 0) {
+            return cb(0);
+        }
+#if USE_IO_URING
+        if (io_context::get().m_uring_enabled) {
+            return _uring_writev(iov, iovcnt, 0, std::move(cb), stop);
+        }
+#endif
+        return _epoll_writev(iov, iovcnt, 0, std::move(cb), stop);
+    }
+
+    // 把另一个文件 [offset, offset + count) 的内容直接在内核里发送到本 fd，
+    // 不经过用户态缓冲区；部分发送时自动继续，全部发完才以总字节数回调
+    // io_uring 没有对应的操作，两种后端都走 epoll 等待可写（此时才注册 epoll）
+    void async_sendfile(int in_fd, off_t offset, size_t count,
+                        callback<expected<size_t>> cb, stop_source stop = {}) {
+        if (stop.stop_requested()) {
+            return cb(-ECANCELED);
+        }
+        if (count == 0) {
+            return cb(0);
+        }
+        return _epoll_sendfile(in_fd, offset, count, 0, std::move(cb), stop);
+    }
+
+    static void _skip_empty_iovec(struct iovec *&iov, size_t &iovcnt) noexcept {
+        while (iovcnt != 0 && iov->iov_len == 0) {
+            ++iov;
+            --iovcnt;
+        }
+    }
+
+    // 跳过已经写出的 n 个字节：整段写完的直接跳过，写了一半的调整起点
+    static void _advance_iovec(struct iovec *&iov, size_t &iovcnt,
+                               size_t n) noexcept {
+        while (iovcnt != 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (n != 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+        _skip_empty_iovec(iov, iovcnt);
+    }
+
+    void async_accept(address_resolver::address &addr,
+                      callback<expected<int>> cb, stop_source stop = {}) {
+        if (stop.stop_requested()) {
+            return cb(-ECANCELED);
+        }
+#if USE_IO_URING
+        if (io_context::get().m_uring_enabled) {
+            return _uring_accept(addr, std::move(cb), stop);
+        }
+#endif
+        return _epoll_accept(addr, std::move(cb), stop);
+    }
+
+    void async_connect(address_resolver::address_info const &addr,
+                       callback<expected<int>> cb, stop_source stop = {}) {
+        if (stop.stop_requested()) {
+            return cb(-ECANCELED);
+        }
+#if USE_IO_URING
+        if (io_context::get().m_uring_enabled) {
+            return _uring_connect(addr, std::move(cb), stop);
+        }
+#endif
+        return _epoll_connect(addr, std::move(cb), stop);
+    }
+
+    void _epoll_read(bytes_view buf, callback<expected<size_t>> cb,
+                     stop_source stop) {
+        if (stop.stop_requested()) {
+            return cb(-ECANCELED);
+        }
+        // 已知不可读时直接挂起，省掉一次必然 EAGAIN 的 read
+        if (m_state->m_readable) {
+            auto ret = convert_error<size_t>(read(m_fd, buf.data(), buf.size()));
+            if (!ret.is_error(EAGAIN)) {
+                return io_context::get().complete(cb, ret);
+            }
+        }
+
+        // 如果 read 可以读了，请操作系统，调用，我这个回调
+        return _epoll_wait_readable(
             [this, buf, cb = std::move(cb), stop]() mutable {
-                if (stop.stop_requested()) {
-                    stop.clear_stop_callback();
-                    return cb(-ECANCELED);
-                }
-                auto ret = convert_error<size_t>(write(m_fd, buf.data(), buf.size()));
-                return cb(ret);
+                return _epoll_read(buf, std::move(cb), stop);
             },
-            EPOLLOUT | EPOLLERR | EPOLLONESHOT, stop);
-#else
+            stop);
+    }
+
+    void _epoll_write(bytes_const_view buf, callback<expected<size_t>> cb,
+                      stop_source stop) {
         if (stop.stop_requested()) {
-            stop.clear_stop_callback();
             return cb(-ECANCELED);
         }
-        auto ret = convert_error<size_t>(write(m_fd, buf.data(), buf.size()));
-        if (!ret.is_error(EAGAIN)) {
-            stop.clear_stop_callback();
-            return cb(ret);
+        if (m_state->m_writable) {
+            auto ret = convert_error<size_t>(write(m_fd, buf.data(), buf.size()));
+            if (!ret.is_error(EAGAIN)) {
+                return io_context::get().complete(cb, ret);
+            }
         }
 
         // 如果 write 可以写了，请操作系统，调用，我这个回调
-        return _epoll_callback(
+        return _epoll_wait_writable(
             [this, buf, cb = std::move(cb), stop]() mutable {
-                return async_write(buf, std::move(cb), stop);
+                return _epoll_write(buf, std::move(cb), stop);
             },
-            EPOLLOUT | EPOLLERR | EPOLLET | EPOLLONESHOT, stop);
-#endif
+            stop);
     }
 
-    void async_accept(address_resolver::address &addr,
-                      callback<expected<int>> cb, stop_source stop = {}) {
-#if USE_LEVEL_TRIGGER
-        // 如果 accept 到请求了，请操作系统，调用，我这个回调
-        return _epoll_callback(
-            [this, &addr, cb = std::move(cb), stop]() mutable {
-                if (stop.stop_requested()) {
-                    stop.clear_stop_callback();
-                    return cb(-ECANCELED);
-                }
-                auto ret = convert_error<int>(accept(m_fd, &addr.m_addr, &addr.m_addrlen));
-                return cb(ret);
+    void _epoll_writev(struct iovec *iov, size_t iovcnt, size_t written,
+                       callback<expected<size_t>> cb, stop_source stop) {
+        if (stop.stop_requested()) {
+            return cb(-ECANCELED);
+        }
+        while (m_state->m_writable) {
+            auto ret = convert_error<size_t>(
+                writev(m_fd, iov, static_cast<int>(std::min<size_t>(iovcnt, IOV_MAX))));
+            if (ret.is_error(EAGAIN)) {
+                break;
+            }
+            if (ret.error()) {
+                return io_context::get().complete(cb, ret);
+            }
+            written += ret.value();
+            _advance_iovec(iov, iovcnt, ret.value());
+            if (iovcnt == 0) {
+                return io_context::get().complete(cb, written);
+            }
+        }
+
+        return _epoll_wait_writable(
+            [this, iov, iovcnt, written, cb = std::move(cb), stop]() mutable {
+                return _epoll_writev(iov, iovcnt, written, std::move(cb), stop);
             },
-            EPOLLIN | EPOLLERR | EPOLLONESHOT, stop);
-#else
+            stop);
+    }
+
+    void _epoll_sendfile(int in_fd, off_t offset, size_t count, size_t written,
+                         callback<expected<size_t>> cb, stop_source stop) {
         if (stop.stop_requested()) {
-            stop.clear_stop_callback();
             return cb(-ECANCELED);
         }
-        auto ret =
-            convert_error<int>(accept(m_fd, &addr.m_addr, &addr.m_addrlen));
-        if (!ret.is_error(EAGAIN)) {
-            stop.clear_stop_callback();
-            return cb(ret);
+        while (m_state->m_writable) {
+            // 单次 sendfile 最多 0x7ffff000 字节，剩下的循环继续
+            auto ret = convert_error<size_t>(
+                sendfile(m_fd, in_fd, &offset, std::min<size_t>(count, 0x7ffff000)));
+            if (ret.is_error(EAGAIN)) {
+                break;
+            }
+            if (ret.error()) {
+                return io_context::get().complete(cb, ret);
+            }
+            if (ret.value() == 0) {
+                // 文件在发送过程中被截短了，已经发出的头部长度无法兑现
+                return io_context::get().complete(cb, expected<size_t>(-EIO));
+            }
+            written += ret.value();
+            count -= ret.value();
+            if (count == 0) {
+                return io_context::get().complete(cb, written);
+            }
+        }
+
+        return _epoll_wait_writable(
+            [this, in_fd, offset, count, written, cb = std::move(cb),
+             stop]() mutable {
+                return _epoll_sendfile(in_fd, offset, count, written,
+                                       std::move(cb), stop);
+            },
+            stop);
+    }
+
+    void _epoll_accept(address_resolver::address &addr,
+                       callback<expected<int>> cb, stop_source stop) {
+        if (stop.stop_requested()) {
+            return cb(-ECANCELED);
+        }
+        if (m_state->m_readable) {
+            auto ret =
+                convert_error<int>(accept(m_fd, &addr.m_addr, &addr.m_addrlen));
+            if (!ret.is_error(EAGAIN)) {
+                return io_context::get().complete(cb, ret);
+            }
         }
 
         // 如果 accept 到请求了，请操作系统，调用，我这个回调
-        return _epoll_callback(
+        return _epoll_wait_readable(
             [this, &addr, cb = std::move(cb), stop]() mutable {
-                return async_accept(addr, std::move(cb), stop);
+                return _epoll_accept(addr, std::move(cb), stop);
             },
-            EPOLLIN | EPOLLERR | EPOLLET | EPOLLONESHOT, stop);
-#endif
+            stop);
     }
 
-    void async_connect(address_resolver::address_info const &addr,
-                       callback<expected<int>> cb, stop_source stop = {}) {
+    void _epoll_connect(address_resolver::address_info const &addr,
+                        callback<expected<int>> cb, stop_source stop) {
         if (stop.stop_requested()) {
-            stop.clear_stop_callback();
             return cb(-ECANCELED);
         }
         auto addr_ptr = addr.get_address();
         auto ret =
             convert_error(connect(m_fd, addr_ptr.m_addr, addr_ptr.m_addrlen));
         if (!ret.is_error(EINPROGRESS)) {
-            stop.clear_stop_callback();
             return cb(ret);
         }
-        return _epoll_callback(
+        return _epoll_wait_writable(
             [this, cb = std::move(cb), stop]() mutable {
                 if (stop.stop_requested()) {
-                    stop.clear_stop_callback();
                     return cb(-ECANCELED);
                 }
                 int ret;
@@ -337,10 +998,9 @@ struct async_file : file_descriptor {
                 if (ret > 0) {
                     ret = -ret;
                 }
-                stop.clear_stop_callback();
                 return cb(ret);
             },
-            EPOLLOUT | EPOLLERR | EPOLLONESHOT, stop);
+            stop);
     }
 
     static async_file async_bind(address_resolver::address_info const &addr) {
@@ -356,13 +1016,29 @@ struct async_file : file_descriptor {
     }
 
     async_file(async_file &&) = default;
-    async_file &operator=(async_file &&) = default;
+
+    async_file &operator=(async_file &&that) noexcept {
+        file_descriptor::operator=(std::move(that));
+        std::swap(m_state, that.m_state);
+        return *this;
+    }
 
     ~async_file() {
         if (m_fd == -1) {
             return;
         }
-        epoll_ctl(io_context::get().m_epfd, EPOLL_CTL_DEL, m_fd, nullptr);
+        if (m_state->m_registered) {
+            epoll_ctl(io_context::get().m_epfd, EPOLL_CTL_DEL, m_fd, nullptr);
+        }
+        // 丢弃还挂着的等待者，不能让 stop_source 再回调到已释放的状态
+        if (m_state->m_read_waiter) {
+            m_state->_take_read_waiter();
+            --io_context::get().m_epcount;
+        }
+        if (m_state->m_write_waiter) {
+            m_state->_take_write_waiter();
+            --io_context::get().m_epcount;
+        }
     }
 
     explicit operator bool() const noexcept {
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include "expected.hpp"
+
+// 不依赖 liburing，直接用系统调用操作 io_uring 的提交队列（SQ）和完成队列（CQ）
+// 只在 io_context 所在的线程使用，不需要考虑多个提交者
+struct io_uring_queue {
+    int m_ring_fd = -1;
+
+    unsigned *m_sq_head = nullptr;
+    unsigned *m_sq_tail = nullptr;
+    unsigned *m_sq_array = nullptr;
+    unsigned m_sq_mask = 0;
+    unsigned m_sq_entries = 0;
+    unsigned m_sq_local_tail = 0; // 已经填好但还没有发布给内核的 SQE 末尾
+    struct io_uring_sqe *m_sqes = nullptr;
+
+    unsigned *m_cq_head = nullptr;
+    unsigned *m_cq_tail = nullptr;
+    unsigned m_cq_mask = 0;
+    struct io_uring_cqe *m_cqes = nullptr;
+
+    void *m_ring_ptr = nullptr;
+    size_t m_ring_size = 0;
+    size_t m_sqes_size = 0;
+
+    io_uring_queue() = default;
+    io_uring_queue(io_uring_queue &&) = delete;
+
+    ~io_uring_queue() {
+        if (m_sqes) {
+            munmap(m_sqes, m_sqes_size);
+        }
+        if (m_ring_ptr) {
+            munmap(m_ring_ptr, m_ring_size);
+        }
+        if (m_ring_fd != -1) {
+            close(m_ring_fd);
+        }
+    }
+
+    static int _setup(unsigned entries, struct io_uring_params *params) {
+        return syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    // 内核不支持（ENOSYS）、被 seccomp 禁止（EPERM）或者缺少需要的特性时
+    // 返回 false，由调用者退回 epoll
+    [[nodiscard]] bool init(unsigned entries) noexcept {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_SETUP_DEFER_TASKRUN)
+        params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+        m_ring_fd = _setup(entries, &params);
+        if (m_ring_fd == -1 && errno == EINVAL) {
+            std::memset(&params, 0, sizeof(params));
+            m_ring_fd = _setup(entries, &params);
+        }
+#else
+        m_ring_fd = _setup(entries, &params);
+#endif
+        if (m_ring_fd == -1) {
+            return false;
+        }
+        // 需要 SINGLE_MMAP（5.4）、NODROP（5.5）和带超时的等待 EXT_ARG（5.11）
+        unsigned required =
+            IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+        if ((params.features & required) != required) {
+            return false;
+        }
+
+        size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cq_size = params.cq_off.cqes +
+                         params.cq_entries * sizeof(struct io_uring_cqe);
+        m_ring_size = sq_size > cq_size ? sq_size : cq_size;
+        void *ring = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+        if (ring == MAP_FAILED) {
+            return false;
+        }
+        m_ring_ptr = ring;
+        m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        m_sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+        char *base = static_cast<char *>(ring);
+        m_sq_head = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+        m_sq_array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+        m_sq_mask = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+        m_sq_entries = params.sq_entries;
+        m_sq_local_tail = *m_sq_tail;
+
+        m_cq_head = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe *>(base + params.cq_off.cqes);
+        return true;
+    }
+
+    unsigned _sq_pending() const noexcept {
+        return m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    // 取得一个空闲的 SQE，队列满时先把已有的批量提交掉
+    struct io_uring_sqe *get_sqe() {
+        if (_sq_pending() >= m_sq_entries) {
+            submit_and_wait(0, nullptr);
+        }
+        unsigned index = m_sq_local_tail & m_sq_mask;
+        struct io_uring_sqe *sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[index] = index;
+        ++m_sq_local_tail;
+        return sqe;
+    }
+
+    // 一次 io_uring_enter 同时提交所有积攒的 SQE 并等待至少 wait_nr 个完成
+    int submit_and_wait(unsigned wait_nr,
+                        struct __kernel_timespec const *timeout) {
+        unsigned to_submit = _sq_pending(); // 包括上次没能提交成功的
+        __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+        unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        struct io_uring_getevents_arg arg;
+        std::memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uintptr_t>(timeout);
+        int ret = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, wait_nr,
+                          flags, &arg, sizeof(arg));
+        if (ret == -1 && (errno == ETIME || errno == EINTR || errno == EBUSY)) {
+            return 0;
+        }
+        return convert_error(ret).expect("io_uring_enter");
+    }
+
+    // 依次处理所有已完成的 CQE，处理函数里可以继续 get_sqe
+    template <class F>
+    void for_each_cqe(F &&f) {
+        unsigned head = *m_cq_head;
+        while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+            ++head;
+            // 先归还 CQE 槽位再调用回调，回调里可能会提交新的操作
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+            f(cqe.user_data, cqe.res);
+        }
+    }
+
+    static void prep_rw(struct io_uring_sqe *sqe, int op, int fd,
+                        void const *addr, unsigned len, uint64_t offset) {
+        sqe->opcode = op;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(addr);
+        sqe->len = len;
+        sqe->off = offset;
+    }
+};
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "bytes_buffer.hpp"
+#include "callback.hpp"
+
+// iobuf 的一个内存段，带引用计数，被多个 iobuf 的切片共享
+// 自有内存紧跟在段头后面一起分配；外部内存只记下地址，引用归零时调用 m_release
+// 引用计数是原子的：请求正文等数据会交给工作线程处理
+struct _iobuf_segment {
+    std::atomic<size_t> m_refcount{1};
+    char *m_data = nullptr;
+    size_t m_size = 0;     // 已经写入的字节数
+    size_t m_capacity = 0; // 外部内存为 0，不能继续追加
+    callback<> m_release;
+
+    static constexpr size_t _default_capacity = 4096 - 64;
+
+    static _iobuf_segment *make_owned(size_t capacity) {
+        void *p = ::operator new(sizeof(_iobuf_segment) + capacity);
+        auto *seg = ::new (p) _iobuf_segment;
+        seg->m_data = reinterpret_cast<char *>(seg + 1);
+        seg->m_capacity = capacity;
+        return seg;
+    }
+
+    static _iobuf_segment *make_foreign(char const *data, size_t size,
+                                        callback<> release) {
+        auto *seg = new _iobuf_segment;
+        seg->m_data = const_cast<char *>(data);
+        seg->m_size = size;
+        seg->m_release = std::move(release);
+        return seg;
+    }
+
+    bool is_owned() const noexcept {
+        return m_capacity != 0;
+    }
+
+    void add_ref() noexcept {
+        m_refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() noexcept {
+        if (m_refcount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        if (is_owned()) {
+            this->~_iobuf_segment();
+            ::operator delete(static_cast<void *>(this));
+            return;
+        }
+        if (m_release) {
+            m_release();
+        }
+        delete this;
+    }
+};
+
+// 由若干切片串起来的缓冲区：追加外部内存、切片、合并都不复制数据，
+// 可以直接转成 iovec 数组交给 writev
+struct iobuf {
+    struct _slice {
+        _iobuf_segment *m_seg;
+        char const *m_data;
+        size_t m_size;
+    };
+
+    std::vector<_slice> m_slices;
+    size_t m_size = 0;
+
+    iobuf() = default;
+
+    iobuf(iobuf &&that) noexcept
+        : m_slices(std::move(that.m_slices)),
+          m_size(std::exchange(that.m_size, 0)) {
+        that.m_slices.clear();
+    }
+
+    iobuf &operator=(iobuf &&that) noexcept {
+        if (this != &that) {
+            clear();
+            m_slices.swap(that.m_slices);
+            m_size = std::exchange(that.m_size, 0);
+        }
+        return *this;
+    }
+
+    // 复制只增加各个段的引用计数
+    explicit iobuf(iobuf const &that) : m_slices(that.m_slices), m_size(that.m_size) {
+        for (auto &s: m_slices) {
+            s.m_seg->add_ref();
+        }
+    }
+
+    ~iobuf() {
+        clear();
+    }
+
+    size_t size() const noexcept {
+        return m_size;
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    size_t segment_count() const noexcept {
+        return m_slices.size();
+    }
+
+    // 丢弃所有数据；m_slices 的容量保留，方便复用
+    void clear() noexcept {
+        for (auto &s: m_slices) {
+            s.m_seg->release();
+        }
+        m_slices.clear();
+        m_size = 0;
+    }
+
+    // 末尾的段是否是独占的自有内存，并且还有空间可以接着写
+    _iobuf_segment *_writable_tail() const noexcept {
+        if (m_slices.empty()) {
+            return nullptr;
+        }
+        auto &s = m_slices.back();
+        _iobuf_segment *seg = s.m_seg;
+        if (!seg->is_owned() ||
+            seg->m_refcount.load(std::memory_order_relaxed) != 1 ||
+            s.m_data + s.m_size != seg->m_data + seg->m_size ||
+            seg->m_size == seg->m_capacity) {
+            return nullptr;
+        }
+        return seg;
+    }
+
+    void _push_slice(_iobuf_segment *seg, char const *data, size_t size) {
+        m_slices.push_back({seg, data, size});
+        m_size += size;
+    }
+
+    // 复制追加：先填满末尾段的剩余空间，不够时再分配新段
+    void append(bytes_const_view chunk) {
+        char const *p = chunk.data();
+        size_t n = chunk.size();
+        if (n == 0) {
+            return;
+        }
+        if (_iobuf_segment *seg = _writable_tail()) {
+            size_t k = std::min(n, seg->m_capacity - seg->m_size);
+            std::memcpy(seg->m_data + seg->m_size, p, k);
+            seg->m_size += k;
+            m_slices.back().m_size += k;
+            m_size += k;
+            p += k;
+            n -= k;
+        }
+        if (n != 0) {
+            auto *seg = _iobuf_segment::make_owned(
+                std::max(n, _iobuf_segment::_default_capacity));
+            std::memcpy(seg->m_data, p, n);
+            seg->m_size = n;
+            _push_slice(seg, seg->m_data, n);
+        }
+    }
+
+    void append(std::string_view chunk) {
+        append(bytes_const_view{chunk.data(), chunk.size()});
+    }
+
+    // O(1) 追加外部内存，不复制；所有引用都释放后调用 release 归还
+    void append_foreign(bytes_const_view chunk, callback<> release = nullptr) {
+        if (chunk.size() == 0) {
+            if (release) {
+                release();
+            }
+            return;
+        }
+        auto *seg = _iobuf_segment::make_foreign(chunk.data(), chunk.size(),
+                                                 std::move(release));
+        _push_slice(seg, seg->m_data, chunk.size());
+    }
+
+    // O(1) 接管一个 std::string 的内存
+    void append_owned(std::string &&str) {
+        if (str.size() < 256) {
+            return append(std::string_view{str}); // 小字符串复制更划算
+        }
+        auto *owner = new std::string(std::move(str));
+        append_foreign(bytes_const_view{owner->data(), owner->size()},
+                       [owner] { delete owner; });
+    }
+
+    // O(1) 追加另一个 iobuf，共享它的段
+    void append(iobuf const &that) {
+        m_slices.reserve(m_slices.size() + that.m_slices.size());
+        for (auto &s: that.m_slices) {
+            s.m_seg->add_ref();
+            _push_slice(s.m_seg, s.m_data, s.m_size);
+        }
+    }
+
+    void append(iobuf &&that) {
+        if (m_slices.empty()) {
+            *this = std::move(that);
+            return;
+        }
+        m_slices.insert(m_slices.end(), that.m_slices.begin(), that.m_slices.end());
+        m_size += that.m_size;
+        that.m_slices.clear();
+        that.m_size = 0;
+    }
+
+    // 直接往末尾写：先 prepare 取得至少 n 字节的可写空间，写入后 commit
+    bytes_view prepare(size_t n) {
+        _iobuf_segment *seg = _writable_tail();
+        if (!seg || seg->m_capacity - seg->m_size < n) {
+            seg = _iobuf_segment::make_owned(
+                std::max(n, _iobuf_segment::_default_capacity));
+            _push_slice(seg, seg->m_data, 0);
+        }
+        return {seg->m_data + seg->m_size, seg->m_capacity - seg->m_size};
+    }
+
+    void commit(size_t n) noexcept {
+        assert(!m_slices.empty());
+        _iobuf_segment *seg = m_slices.back().m_seg;
+        assert(seg->m_size + n <= seg->m_capacity);
+        seg->m_size += n;
+        m_slices.back().m_size += n;
+        m_size += n;
+    }
+
+    // 从头部丢弃 n 个字节
+    void consume(size_t n) {
+        if (n > m_size) {
+            throw std::out_of_range("iobuf::consume");
+        }
+        m_size -= n;
+        size_t i = 0;
+        while (n != 0 && n >= m_slices[i].m_size) {
+            n -= m_slices[i].m_size;
+            m_slices[i].m_seg->release();
+            ++i;
+        }
+        m_slices.erase(m_slices.begin(), m_slices.begin() + i);
+        if (n != 0) {
+            m_slices.front().m_data += n;
+            m_slices.front().m_size -= n;
+        }
+    }
+
+    // 取 [start, start + len) 这一段，和本对象共享内存
+    iobuf slice(size_t start, size_t len = static_cast<size_t>(-1)) const {
+        if (start > m_size) {
+            throw std::out_of_range("iobuf::slice");
+        }
+        if (len > m_size - start) {
+            len = m_size - start;
+        }
+        iobuf result;
+        for (auto &s: m_slices) {
+            if (len == 0) {
+                break;
+            }
+            if (start >= s.m_size) {
+                start -= s.m_size;
+                continue;
+            }
+            size_t k = std::min(len, s.m_size - start);
+            s.m_seg->add_ref();
+            result._push_slice(s.m_seg, s.m_data + start, k);
+            start = 0;
+            len -= k;
+        }
+        return result;
+    }
+
+    // 第一个非空的段
+    bytes_const_view front() const noexcept {
+        for (auto &s: m_slices) {
+            if (s.m_size != 0) {
+                return {s.m_data, s.m_size};
+            }
+        }
+        return {nullptr, 0};
+    }
+
+    template <class F>
+    void for_each_segment(F &&f) const {
+        for (auto &s: m_slices) {
+            f(bytes_const_view{s.m_data, s.m_size});
+        }
+    }
+
+    // 填写最多 max 个 iovec，返回实际填写的个数
+    size_t fill_iovec(struct iovec *iov, size_t max) const noexcept {
+        size_t n = std::min(max, m_slices.size());
+        for (size_t i = 0; i < n; ++i) {
+            iov[i].iov_base = const_cast<char *>(m_slices[i].m_data);
+            iov[i].iov_len = m_slices[i].m_size;
+        }
+        return n;
+    }
+
+    std::vector<struct iovec> iovecs() const {
+        std::vector<struct iovec> iov(m_slices.size());
+        fill_iovec(iov.data(), iov.size());
+        return iov;
+    }
+
+    // 只有一段时直接给出视图，否则为 false，调用者需要 to_string()
+    bool is_contiguous() const noexcept {
+        return m_slices.size() <= 1;
+    }
+
+    std::string_view contiguous_view() const noexcept {
+        assert(is_contiguous());
+        if (m_slices.empty()) {
+            return {};
+        }
+        return {m_slices.front().m_data, m_slices.front().m_size};
+    }
+
+    void copy_to(char *dst) const noexcept {
+        for (auto &s: m_slices) {
+            std::memcpy(dst, s.m_data, s.m_size);
+            dst += s.m_size;
+        }
+    }
+
+    // 需要连续内存的旧接口用，会复制一次
+    std::string to_string() const {
+        std::string str;
+        str.resize(m_size);
+        copy_to(str.data());
+        return str;
+    }
+};
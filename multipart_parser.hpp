@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <strings.h>
+#include <string>
+#include <string_view>
+#include "bytes_buffer.hpp"
+#include "callback.hpp"
+#include "string_map.hpp"
+
+// Boyer-Moore-Horspool：按模式串最后一个字节的跳跃表一次跳过多个字节，
+// multipart 的分隔符一般有四五十个字节，平均每次能跳过差不多这么长
+struct _bmh_searcher {
+    std::string m_pattern;
+    std::array<size_t, 256> m_skip;
+
+    explicit _bmh_searcher(std::string pattern = {}) : m_pattern(std::move(pattern)) {
+        size_t n = m_pattern.size();
+        m_skip.fill(n);
+        for (size_t i = 0; i + 1 < n; ++i) {
+            m_skip[static_cast<unsigned char>(m_pattern[i])] = n - 1 - i;
+        }
+    }
+
+    size_t find(std::string_view hay) const noexcept {
+        size_t n = m_pattern.size();
+        if (n == 0 || hay.size() < n) {
+            return std::string_view::npos;
+        }
+        char last = m_pattern[n - 1];
+        size_t pos = 0;
+        while (pos + n <= hay.size()) {
+            char c = hay[pos + n - 1];
+            if (c == last && std::memcmp(hay.data() + pos, m_pattern.data(), n - 1) == 0) {
+                return pos;
+            }
+            pos += m_skip[static_cast<unsigned char>(c)];
+        }
+        return std::string_view::npos;
+    }
+};
+
+// multipart 中的一个部分（表单字段或者文件）的头部
+struct multipart_part {
+    string_map headers;       // 键已经转为小写
+    std::string name;         // Content-Disposition 的 name
+    std::string filename;     // Content-Disposition 的 filename，普通字段为空
+    std::string content_type; // 没有给出时为空（按 RFC 7578 视为 text/plain）
+};
+
+// 增量的 multipart/form-data 解析器：正文可以分成任意大小的块喂进来，
+// 每解析出一个部分的头部就调用 on_part_begin，正文数据直接以输入块的切片
+// 交给 on_part_data（可能调用多次），部分结束时调用 on_part_end
+// 只有可能是分隔符开头的几个字节需要留到下一块，其余数据都不复制
+struct multipart_parser {
+    enum _state_t {
+        _preamble,  // 第一个分隔符之前，数据丢弃
+        _delimiter, // 分隔符之后：等待 "--"（结束）或者 "\r\n"（下一个部分）
+        _headers,
+        _body,
+        _epilogue, // 结束分隔符之后，数据丢弃
+        _error,
+    };
+
+    callback<multipart_part const &> on_part_begin;
+    callback<bytes_const_view> on_part_data;
+    callback<> on_part_end;
+
+    _bmh_searcher m_delimiter; // "\r\n--" + boundary
+    _state_t m_state = _preamble;
+    std::string m_tail;   // 上一块末尾可能是分隔符开头的字节
+    std::string m_header; // 正在积累的部分头部
+    size_t m_max_header_size = 16 * 1024;
+    multipart_part m_part;
+
+    explicit multipart_parser(std::string_view boundary)
+        : m_delimiter("\r\n--" + std::string(boundary)) {
+        // 第一个分隔符前面没有 "\r\n"，补上之后所有分隔符可以统一处理
+        m_tail = "\r\n";
+    }
+
+    multipart_parser(multipart_parser &&) = delete;
+
+    // 从 Content-Type 中取出 boundary 参数，没有时返回空
+    static std::string boundary_from_content_type(std::string_view content_type) {
+        size_t semi = content_type.find(';');
+        if (content_type.substr(0, semi).find("multipart/") == std::string_view::npos) {
+            return {};
+        }
+        while (semi != std::string_view::npos) {
+            std::string_view param = content_type.substr(semi + 1);
+            semi = param.find(';');
+            param = param.substr(0, semi);
+            while (!param.empty() && param.front() == ' ') {
+                param.remove_prefix(1);
+            }
+            if (param.size() > 9 && strncasecmp(param.data(), "boundary=", 9) == 0) {
+                std::string_view value = param.substr(9);
+                while (!value.empty() && value.back() == ' ') {
+                    value.remove_suffix(1);
+                }
+                if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+                    value = value.substr(1, value.size() - 2);
+                }
+                if (value.empty() || value.size() > 70) {
+                    return {};
+                }
+                return std::string(value);
+            }
+        }
+        return {};
+    }
+
+    [[nodiscard]] bool finished() const noexcept {
+        return m_state == _epilogue;
+    }
+
+    [[nodiscard]] bool failed() const noexcept {
+        return m_state == _error;
+    }
+
+    // 格式错误时返回 false，之后的数据都会被忽略
+    bool push_chunk(bytes_const_view chunk) {
+        std::string_view data(chunk.data(), chunk.size());
+        while (!data.empty()) {
+            switch (m_state) {
+            case _preamble:
+            case _body: data = _push_body(data); break;
+            case _delimiter: data = _push_delimiter(data); break;
+            case _headers: data = _push_headers(data); break;
+            case _epilogue: return true;
+            case _error: return false;
+            }
+        }
+        return m_state != _error;
+    }
+
+    void _emit_data(std::string_view data) {
+        if (m_state == _body && !data.empty() && on_part_data) {
+            on_part_data(multishot_call, bytes_const_view{data.data(), data.size()});
+        }
+    }
+
+    void _found_delimiter() {
+        if (m_state == _body && on_part_end) {
+            on_part_end(multishot_call);
+        }
+        m_state = _delimiter;
+    }
+
+    std::string_view _push_body(std::string_view data) {
+        std::string_view pattern = m_delimiter.m_pattern;
+        size_t plen = pattern.size();
+        if (!m_tail.empty()) {
+            // 分隔符可能从上一块的末尾开始：只在 m_tail 加上本块开头的
+            // 不超过 plen 个字节里找，不复制整块
+            std::string probe = m_tail + std::string(data.substr(0, plen));
+            for (size_t i = 0; i < m_tail.size(); ++i) {
+                size_t n = std::min(plen, probe.size() - i);
+                if (probe.compare(i, n, pattern, 0, n) != 0) {
+                    continue;
+                }
+                _emit_data(std::string_view(m_tail).substr(0, i));
+                if (n == plen) {
+                    size_t used = plen - (m_tail.size() - i);
+                    m_tail.clear();
+                    _found_delimiter();
+                    return data.substr(used);
+                }
+                // 本块太短，还是只匹配了一部分
+                m_tail = probe.substr(i);
+                return {};
+            }
+            _emit_data(m_tail);
+            m_tail.clear();
+        }
+        size_t pos = m_delimiter.find(data);
+        if (pos != std::string_view::npos) {
+            _emit_data(data.substr(0, pos));
+            _found_delimiter();
+            return data.substr(pos + plen);
+        }
+        // 末尾可能是分隔符的开头，留到下一块再判断
+        size_t keep = std::min(plen - 1, data.size());
+        while (keep != 0 && data.substr(data.size() - keep) != pattern.substr(0, keep)) {
+            --keep;
+        }
+        _emit_data(data.substr(0, data.size() - keep));
+        m_tail = data.substr(data.size() - keep);
+        return {};
+    }
+
+    std::string_view _push_delimiter(std::string_view data) {
+        // 最多两个字节，借用 m_header 暂存
+        while (!data.empty() && m_header.size() < 2) {
+            m_header.push_back(data.front());
+            data.remove_prefix(1);
+        }
+        if (m_header.size() < 2) {
+            return data;
+        }
+        if (m_header == "--") {
+            m_header.clear();
+            m_state = _epilogue;
+        } else if (m_header == "\r\n") {
+            m_header.clear();
+            m_part = multipart_part();
+            m_state = _headers;
+        } else {
+            m_state = _error;
+        }
+        return data;
+    }
+
+    std::string_view _push_headers(std::string_view data) {
+        size_t old_size = m_header.size();
+        m_header.append(data);
+        // 没有头部的部分：分隔符后面直接是空行
+        size_t end = m_header.compare(0, 2, "\r\n") == 0
+                         ? 0
+                         : m_header.find("\r\n\r\n", old_size < 3 ? 0 : old_size - 3);
+        if (end == std::string::npos) {
+            if (m_header.size() > m_max_header_size) {
+                m_state = _error;
+            }
+            return {};
+        }
+        size_t header_len = end == 0 ? 2 : end + 4;
+        std::string_view rest = data.substr(header_len - old_size);
+        m_header.resize(end);
+        _parse_headers();
+        m_header.clear();
+        m_state = _body;
+        if (on_part_begin) {
+            on_part_begin(multishot_call, m_part);
+        }
+        return rest;
+    }
+
+    void _parse_headers() {
+        std::string_view header = m_header;
+        while (!header.empty()) {
+            size_t eol = header.find("\r\n");
+            std::string_view line = header.substr(0, eol);
+            header = eol == std::string_view::npos ? std::string_view{}
+                                                   : header.substr(eol + 2);
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            std::string key(line.substr(0, colon));
+            for (char &c: key) {
+                if ('A' <= c && c <= 'Z') {
+                    c += 'a' - 'A';
+                }
+            }
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ') {
+                value.remove_prefix(1);
+            }
+            m_part.headers.insert_or_assign(std::move(key), value);
+        }
+        auto it = m_part.headers.find("content-disposition");
+        if (it != m_part.headers.end()) {
+            m_part.name = _disposition_param(it->second, "name");
+            m_part.filename = _disposition_param(it->second, "filename");
+        }
+        it = m_part.headers.find("content-type");
+        if (it != m_part.headers.end()) {
+            m_part.content_type = it->second;
+        }
+    }
+
+    // form-data; name="image"; filename="a.png" 中取出某个参数的值
+    static std::string _disposition_param(std::string_view value, std::string_view key) {
+        size_t semi = value.find(';');
+        while (semi != std::string_view::npos) {
+            value = value.substr(semi + 1);
+            semi = value.find(';');
+            std::string_view param = value.substr(0, semi);
+            while (!param.empty() && param.front() == ' ') {
+                param.remove_prefix(1);
+            }
+            size_t eq = param.find('=');
+            if (eq == std::string_view::npos || param.substr(0, eq) != key) {
+                continue;
+            }
+            std::string_view v = param.substr(eq + 1);
+            if (!v.empty() && v.front() == '"') {
+                // 带引号的值里可能有 ';'，找配对的引号
+                size_t close = value.find('"', (v.data() - value.data()) + 1);
+                if (close == std::string_view::npos) {
+                    return {};
+                }
+                return std::string(value.substr(v.data() - value.data() + 1,
+                                                 close - (v.data() - value.data()) - 1));
+            }
+            return std::string(v);
+        }
+        return {};
+    }
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// 对象池的命中统计：命中表示这次没有调用 new
+struct pool_stats {
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+    size_t m_in_use = 0; // 已经取出、尚未归还的个数
+    size_t m_free = 0;   // 池中空闲、可以直接复用的个数
+
+    double hit_rate() const noexcept {
+        size_t total = m_hits + m_misses;
+        return total ? static_cast<double>(m_hits) / total : 0.0;
+    }
+
+    pool_stats &operator+=(pool_stats const &that) noexcept {
+        m_hits += that.m_hits;
+        m_misses += that.m_misses;
+        m_in_use += that.m_in_use;
+        m_free += that.m_free;
+        return *this;
+    }
+};
+
+// 大小相同的内存块的空闲链表，给 shared_ptr 的控制块这类小分配复用，
+// 块大小在第一次归还时确定，其他大小的分配照常走 operator new
+struct _block_list {
+    struct _block {
+        _block *m_next;
+    };
+
+    _block *m_free = nullptr;
+    size_t m_block_size = 0;
+
+    _block_list() = default;
+    _block_list(_block_list &&) = delete;
+
+    ~_block_list() {
+        while (m_free) {
+            ::operator delete(std::exchange(m_free, m_free->m_next));
+        }
+    }
+
+    void *allocate(size_t size) {
+        if (m_free && size == m_block_size) {
+            return std::exchange(m_free, m_free->m_next);
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void *p, size_t size) noexcept {
+        if (m_block_size == 0 && size >= sizeof(_block)) {
+            m_block_size = size;
+        }
+        if (size != m_block_size) {
+            return ::operator delete(p);
+        }
+        auto *block = static_cast<_block *>(p);
+        block->m_next = m_free;
+        m_free = block;
+    }
+};
+
+// 从 _block_list 分配单个对象的分配器，数组照常走 std::allocator
+template <class T>
+struct _block_allocator {
+    using value_type = T;
+
+    _block_list *m_blocks;
+
+    explicit _block_allocator(_block_list *blocks) noexcept : m_blocks(blocks) {}
+
+    template <class U>
+    _block_allocator(_block_allocator<U> const &that) noexcept
+        : m_blocks(that.m_blocks) {}
+
+    T *allocate(size_t n) {
+        if (n == 1) {
+            return static_cast<T *>(m_blocks->allocate(sizeof(T)));
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        if (n == 1) {
+            return m_blocks->deallocate(p, sizeof(T));
+        }
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <class U>
+    bool operator==(_block_allocator<U> const &that) const noexcept {
+        return m_blocks == that.m_blocks;
+    }
+
+    template <class U>
+    bool operator!=(_block_allocator<U> const &that) const noexcept {
+        return m_blocks != that.m_blocks;
+    }
+};
+
+// 线程局部的对象池：归还的对象不析构，只调用 reset_state()，
+// 对象内部各个缓冲区已经分配的容量原样留给下一次使用
+// 每个线程只跑一个 io_context，所以也就是每个 io_context 一个池
+template <class T>
+struct object_pool {
+    // 声明在 m_free 之前，析构时最后释放：池中对象的 enable_shared_from_this
+    // 还弱引用着上一次的控制块，删除对象时控制块才归还到这里
+    _block_list m_blocks;
+    std::vector<T *> m_free;
+    size_t m_max_free = 1024; // 超出的部分直接释放，避免连接高峰过后长期占用内存
+    pool_stats m_stats;
+
+    object_pool() = default;
+    object_pool(object_pool &&) = delete;
+
+    ~object_pool() {
+        for (T *p: m_free) {
+            delete p;
+        }
+    }
+
+    T *acquire() {
+        ++m_stats.m_in_use;
+        if (!m_free.empty()) {
+            ++m_stats.m_hits;
+            T *p = m_free.back();
+            m_free.pop_back();
+            return p;
+        }
+        ++m_stats.m_misses;
+        return new T;
+    }
+
+    void release(T *p) noexcept {
+        --m_stats.m_in_use;
+        p->reset_state();
+        if (m_free.size() >= m_max_free) {
+            delete p;
+            return;
+        }
+        m_free.push_back(p);
+    }
+
+    pool_stats stats() const noexcept {
+        pool_stats s = m_stats;
+        s.m_free = m_free.size();
+        return s;
+    }
+
+    static object_pool &get() {
+        static thread_local object_pool instance;
+        return instance;
+    }
+
+    // 引用计数归零时对象回到池中，控制块也在池里复用
+    static std::shared_ptr<T> make_shared() {
+        object_pool &pool = get();
+        return std::shared_ptr<T>(pool.acquire(),
+                                  [](T *p) { get().release(p); },
+                                  _block_allocator<T>(&pool.m_blocks));
+    }
+};
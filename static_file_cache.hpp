@@ -0,0 +1,300 @@
+#pragma once
+
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "bytes_buffer.hpp"
+#include "http_codec.hpp"
+#include "http_compress.hpp"
+#include "http_date.hpp"
+#include "io_context.hpp"
+#include "stop_source.hpp"
+
+// 静态文件缓存：文件第一次被请求时 mmap 进来，同时生成完整的响应头（含 ETag），
+// 之后命中只是一次查表，不再访问文件系统
+// 文本类文件的 gzip/deflate 版本在第一次被请求时压缩一次，和条目一起缓存；
+// 压缩就在循环线程上进行，会卡住这个循环的所有连接，所以只压缩不超过
+// m_max_compress_size 的文件，等级也不用最高的（更大的文件总是发送原文件）
+// 文件所在目录用 inotify 监视，文件被修改、替换或删除时丢弃对应的条目
+// 每个 io_context 各自一份（由 http_server 持有），不需要加锁
+struct static_file_cache {
+    // 条目的一个压缩版本，ETag 带上编码后缀，和原文件区分开
+    struct variant {
+        std::string m_data;
+        std::string m_etag;
+        bytes_buffer m_header; // 预先生成的 200 响应头（见 make_header）
+
+        bytes_const_view content() const noexcept {
+            return {m_data.data(), m_data.size()};
+        }
+    };
+
+    struct entry {
+        std::string m_path;
+        std::string m_content_type;
+        char *m_data = nullptr; // mmap 的文件内容，空文件为 nullptr
+        size_t m_size = 0;
+        struct timespec m_mtime {};
+        std::string m_etag;    // "\"大小-修改时间\""，带引号
+        std::string m_last_modified;
+        bytes_buffer m_header; // 预先生成的 200 响应头（见 make_header）
+        bool m_compressible = false; // 会发送压缩版本，响应要带 Vary
+        // 下标为 content_coding；第一次需要时才压缩，压缩后不比原文件小的记为空
+        mutable std::unique_ptr<variant const> m_variants[3];
+        mutable bool m_variant_done[3] = {};
+
+        entry() = default;
+        entry(entry &&) = delete;
+
+        ~entry() {
+            if (m_data) {
+                munmap(m_data, m_size);
+            }
+        }
+
+        bytes_const_view content() const noexcept {
+            return {m_data, m_size};
+        }
+    };
+
+    using entry_pointer = std::shared_ptr<entry const>;
+
+    std::unordered_map<std::string, entry_pointer> m_entries;
+    size_t m_max_file_size = 64 * 1024 * 1024; // 更大的文件不缓存，交给 sendfile
+    size_t m_max_compress_size = 1024 * 1024;
+    int m_compress_level = Z_DEFAULT_COMPRESSION; // 即 6，1 MiB 约几十毫秒，最高等级要慢十倍
+
+    async_file m_inotify;
+    std::unordered_map<int, std::string> m_watch_dirs; // wd -> 目录（带结尾 '/'）
+    std::unordered_map<std::string, int> m_dir_watches;
+    bytes_buffer m_event_buf{4096};
+    stop_state m_stop;
+
+    static_file_cache() = default;
+    static_file_cache(static_file_cache &&) = delete;
+
+    // 命中时不做任何系统调用；未命中时加载文件并加入缓存，
+    // 文件不存在或者太大（不适合缓存）时返回 nullptr
+    entry_pointer lookup(std::string const &path, std::string_view content_type) {
+        auto it = m_entries.find(path);
+        if (it != m_entries.end() && it->second->m_content_type == content_type) {
+            return it->second;
+        }
+        entry_pointer e = _load(path, content_type);
+        if (e) {
+            m_entries.insert_or_assign(path, e);
+        }
+        return e;
+    }
+
+    // 条目按 coding 压缩后的版本；不适合压缩时返回 nullptr，应当发送原文件
+    // 返回的指针和条目的生命周期相同
+    variant const *compressed(entry const &e, content_coding coding) const {
+        if (coding == content_coding::identity || !e.m_compressible) {
+            return nullptr;
+        }
+        size_t i = static_cast<size_t>(coding);
+        if (!e.m_variant_done[i]) {
+            e.m_variant_done[i] = true;
+            std::string data = http_compress(e.content(), coding, m_compress_level);
+            if (data.size() < e.m_size) {
+                auto v = std::make_unique<variant>();
+                v->m_data = std::move(data);
+                v->m_etag = e.m_etag;
+                v->m_etag.insert(v->m_etag.size() - 1,
+                                 "-" + std::string(content_coding_name(coding)));
+                v->m_header = make_header(e.m_content_type, v->m_etag,
+                                          e.m_last_modified, coding, true,
+                                          v->m_data.size());
+                e.m_variants[i] = std::move(v);
+            }
+        }
+        return e.m_variants[i].get();
+    }
+
+    void invalidate(std::string const &path) {
+        m_entries.erase(path);
+    }
+
+    void clear() {
+        m_entries.clear();
+    }
+
+    // 停止监视，释放 inotify 上挂着的读取（服务器退出时调用）
+    void stop() {
+        m_stop.request_stop();
+        m_entries.clear();
+    }
+
+    static std::string make_etag(off_t size, struct timespec const &mtime) {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "\"%llx-%llx%09lx\"",
+                      static_cast<unsigned long long>(size),
+                      static_cast<unsigned long long>(mtime.tv_sec),
+                      static_cast<long>(mtime.tv_nsec));
+        return buf;
+    }
+
+    entry_pointer _load(std::string const &path, std::string_view content_type) {
+        if (m_stop.stop_requested()) {
+            return nullptr;
+        }
+        file_descriptor file(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (file.m_fd == -1) {
+            return nullptr;
+        }
+        struct stat st;
+        if (fstat(file.m_fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+            static_cast<size_t>(st.st_size) > m_max_file_size) {
+            return nullptr;
+        }
+        // 先开始监视再读取内容，避免错过两者之间发生的修改
+        if (!_watch_directory_of(path)) {
+            return nullptr;
+        }
+
+        auto e = std::make_shared<entry>();
+        e->m_path = path;
+        e->m_content_type = content_type;
+        e->m_size = st.st_size;
+        e->m_mtime = st.st_mtim;
+        if (e->m_size != 0) {
+            void *p = mmap(nullptr, e->m_size, PROT_READ, MAP_PRIVATE, file.m_fd, 0);
+            if (p == MAP_FAILED) {
+                return nullptr;
+            }
+            e->m_data = static_cast<char *>(p);
+        }
+        e->m_etag = make_etag(st.st_size, st.st_mtim);
+        e->m_last_modified = http_date_format(st.st_mtim.tv_sec);
+        e->m_compressible = http_is_compressible(content_type) &&
+                            e->m_size <= m_max_compress_size;
+        e->m_header = make_header(content_type, e->m_etag, e->m_last_modified,
+                                  content_coding::identity, e->m_compressible,
+                                  e->m_size);
+        return e;
+    }
+
+    // 内容随 Accept-Encoding 变化的（vary）都要带上 Vary，
+    // 否则中间的缓存可能把压缩版本发给不支持的客户端
+    // 只含这个文件特有的几行，以空行结尾；状态行和 Date 等每个响应都一样的行
+    // 由 http_server 发送时写在前面（Date 每秒都在变，不能缓存在这里）
+    static bytes_buffer make_header(std::string_view content_type,
+                                    std::string_view etag,
+                                    std::string_view last_modified,
+                                    content_coding coding, bool vary,
+                                    size_t length) {
+        http_response_writer<> writer;
+        writer.write_header("Content-type", content_type);
+        writer.write_header("ETag", etag);
+        writer.write_header("Last-Modified", last_modified);
+        if (coding == content_coding::identity) {
+            writer.write_header("Accept-Ranges", "bytes");
+        } else {
+            writer.write_header("Content-Encoding", content_coding_name(coding));
+        }
+        if (vary) {
+            writer.write_header("Vary", "Accept-Encoding");
+        }
+        writer.write_content_length(length);
+        writer.end_header();
+        return std::move(writer.buffer());
+    }
+
+    static std::string _directory_of(std::string const &path) {
+        size_t slash = path.rfind('/');
+        if (slash == std::string::npos) {
+            return "";
+        }
+        return path.substr(0, slash + 1);
+    }
+
+    bool _watch_directory_of(std::string const &path) {
+        std::string dir = _directory_of(path);
+        if (m_dir_watches.count(dir)) {
+            return true;
+        }
+        if (!m_inotify) {
+            int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd == -1) {
+                return false; // 无法得知文件变化时不缓存
+            }
+            m_inotify = async_file{fd};
+            _read_events();
+        }
+        int wd = inotify_add_watch(
+            m_inotify.m_fd, dir.empty() ? "." : dir.c_str(),
+            IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_MOVED_TO |
+                IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF);
+        if (wd == -1) {
+            return false;
+        }
+        m_watch_dirs.insert_or_assign(wd, dir);
+        m_dir_watches.insert_or_assign(dir, wd);
+        return true;
+    }
+
+    // 固定走 epoll：缓存析构时挂着的读取会被同步撤销，不会像 io_uring 那样
+    // 在内核里留着一个指向已释放缓冲区的读操作
+    void _read_events() {
+        return m_inotify._epoll_read(
+            m_event_buf,
+            [this](expected<size_t> ret) {
+                if (ret.error()) {
+                    return; // 被 stop() 取消
+                }
+                _handle_events(m_event_buf.subspan(0, ret.value()));
+                return _read_events();
+            },
+            m_stop);
+    }
+
+    void _handle_events(bytes_const_view events) {
+        size_t pos = 0;
+        while (pos + sizeof(struct inotify_event) <= events.size()) {
+            struct inotify_event ev;
+            std::memcpy(&ev, events.data() + pos, sizeof(ev));
+            std::string_view name(events.data() + pos + sizeof(ev), ev.len);
+            name = name.substr(0, name.find('\0'));
+            pos += sizeof(ev) + ev.len;
+
+            if (ev.mask & IN_Q_OVERFLOW) {
+                m_entries.clear(); // 丢失了事件，只能全部作废
+                continue;
+            }
+            auto it = m_watch_dirs.find(ev.wd);
+            if (it == m_watch_dirs.end()) {
+                continue;
+            }
+            std::string const &dir = it->second;
+            if (ev.mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // 目录本身没了：其中的条目全部作废，之后重新建立监视
+                _invalidate_directory(dir);
+                if (ev.mask & IN_IGNORED) {
+                    m_dir_watches.erase(dir);
+                    m_watch_dirs.erase(it);
+                }
+                continue;
+            }
+            invalidate(dir + std::string(name));
+        }
+    }
+
+    void _invalidate_directory(std::string const &dir) {
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            if (_directory_of(it->first) == dir) {
+                it = m_entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+};
@@ -1,55 +1,167 @@
 #pragma once
 
+#include <cassert>
+#include <cstddef>
+#include <utility>
 #include "callback.hpp"
-#include <memory>
 
-struct stop_source {
-    struct _control_block {
-        bool m_stop = false;
-        callback<> m_cb;
-    };
+struct stop_state;
+
+// 侵入式的停止回调节点，嵌在等待者自己的状态里（定时器条目、fd 的等待槽位等），
+// 注册和注销都只是链表操作，不分配内存
+struct stop_callback {
+    stop_callback *m_next = nullptr;
+    stop_callback **m_pprev = nullptr;
+    callback<> m_cb;
+
+    stop_callback() = default;
+    stop_callback(stop_callback &&) = delete;
+
+    ~stop_callback() {
+        reset();
+    }
+
+    bool is_registered() const noexcept {
+        return m_pprev != nullptr;
+    }
+
+    void _unlink() noexcept {
+        *m_pprev = m_next;
+        if (m_next) {
+            m_next->m_pprev = m_pprev;
+        }
+        m_next = nullptr;
+        m_pprev = nullptr;
+    }
+
+    // 注销（如果还在链表上），并丢弃回调
+    void reset() noexcept {
+        if (m_pprev) {
+            _unlink();
+        }
+        m_cb = nullptr;
+    }
+};
+
+// 停止信号本身。可以直接嵌在连接等对象里，也可以由 stop_source::make()
+// 在堆上创建（此时用非原子的引用计数管理，只能在同一个线程使用）
+struct stop_state {
+    stop_callback *m_callbacks = nullptr;
+    size_t m_refcount = 0;
+    bool m_stop = false;
+
+    stop_state() = default;
+    stop_state(stop_state &&) = delete;
+
+    ~stop_state() {
+        // 还没触发的回调不再有机会触发，让它们的节点脱离本对象
+        while (m_callbacks) {
+            m_callbacks->reset();
+        }
+    }
+
+    bool stop_requested() const noexcept {
+        return m_stop;
+    }
+
+    // 所有注册的回调依次被调用，每个只调用一次
+    void request_stop() {
+        m_stop = true;
+        while (m_callbacks) {
+            stop_callback *node = m_callbacks;
+            node->_unlink();
+            // 先移出再调用：回调里可能会销毁节点所在的对象
+            auto cb = std::move(node->m_cb);
+            cb();
+        }
+    }
 
-    std::shared_ptr<_control_block> m_control;
+    // 已经停止时不会注册，返回 false
+    bool add_stop_callback(stop_callback &node, callback<> cb) noexcept {
+        assert(!node.is_registered());
+        if (m_stop) {
+            return false;
+        }
+        node.m_cb = std::move(cb);
+        node.m_next = m_callbacks;
+        if (m_callbacks) {
+            m_callbacks->m_pprev = &node.m_next;
+        }
+        node.m_pprev = &m_callbacks;
+        m_callbacks = &node;
+        return true;
+    }
+
+    // 复用前恢复初始状态（例如连接对象被对象池回收时）
+    void reset() noexcept {
+        assert(!m_callbacks);
+        m_stop = false;
+    }
+};
+
+// stop_state 的句柄，按值传给各个异步操作
+// 指向嵌入式的 stop_state 时不计数，由持有者保证其生命周期足够长
+struct stop_source {
+    stop_state *m_state = nullptr;
+    bool m_owned = false;
 
     stop_source() = default;
 
     explicit stop_source(std::in_place_t)
-        : m_control(std::make_shared<_control_block>()) {}
+        : m_state(new stop_state), m_owned(true) {
+        m_state->m_refcount = 1;
+    }
+
+    stop_source(stop_state &state) noexcept : m_state(&state) {}
 
     static stop_source make() {
         return stop_source(std::in_place);
     }
 
-    bool stop_requested() const noexcept {
-        return m_control && m_control->m_stop;
+    stop_source(stop_source const &that) noexcept
+        : m_state(that.m_state), m_owned(that.m_owned) {
+        if (m_owned) {
+            ++m_state->m_refcount;
+        }
     }
 
-    bool stop_possible() const noexcept {
-        return m_control != nullptr;
+    stop_source(stop_source &&that) noexcept
+        : m_state(std::exchange(that.m_state, nullptr)),
+          m_owned(std::exchange(that.m_owned, false)) {}
+
+    stop_source &operator=(stop_source that) noexcept {
+        std::swap(m_state, that.m_state);
+        std::swap(m_owned, that.m_owned);
+        return *this;
     }
 
-    void request_stop() const {
-        if (!m_control) {
-            return;
-        }
-        m_control->m_stop = true;
-        if (m_control->m_cb) {
-            m_control->m_cb();
-            m_control->m_cb = nullptr;
+    ~stop_source() {
+        if (m_owned && --m_state->m_refcount == 0) {
+            delete m_state;
         }
     }
 
-    void set_stop_callback(callback<> cb) const noexcept {
-        if (!m_control) {
+    bool stop_requested() const noexcept {
+        return m_state && m_state->m_stop;
+    }
+
+    bool stop_possible() const noexcept {
+        return m_state != nullptr;
+    }
+
+    void request_stop() const {
+        if (!m_state) {
             return;
         }
-        m_control->m_cb = std::move(cb);
+        // 回调里可能释放别的句柄，保证本次调用期间 stop_state 不被删除
+        stop_source keep_alive = *this;
+        m_state->request_stop();
     }
 
-    void clear_stop_callback() const noexcept {
-        if (!m_control) {
-            return;
+    bool add_stop_callback(stop_callback &node, callback<> cb) const noexcept {
+        if (!m_state) {
+            return false;
         }
-        m_control->m_cb = nullptr;
+        return m_state->add_stop_callback(node, std::move(cb));
     }
-};
\ No newline at end of file
+};
@@ -1,30 +1,310 @@
 #include "io_context.hpp"
 #include "http_server.hpp"
+#include "http_server_pool.hpp"
 #include "file_utils.hpp"
+#include "image_pipeline.hpp"
+#include "multipart_parser.hpp"
+#include "upload_store.hpp"
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
 #include <unistd.h>
 
-void server() {
-    io_context ctx;
-    chdir("../static");
-    auto server = http_server::make();
-    server->get_router().route("/", [](http_server::http_request &request) {
-        std::string response = file_get_content("picture.html");
-        request.write_response(200, response, "text/html");
+// 静态文件所在的目录（绝对路径），由 server() 在启动线程之前确定；
+// 上传的文件按它拼出路径，不依赖当前目录
+std::string static_root = ".";
+
+// 流式上传：每读到一块就交给阻塞 I/O 线程池写盘，写完再读下一块，
+// 磁盘慢的时候自然也就不再从连接读取
+// 每个上传写自己的临时文件，全部收完才改名为 upload.bin，
+// 同时进行的上传不会互相截断、交错；中途失败或断开时删除临时文件
+struct upload_state {
+    http_server::http_request &m_request;
+    file_descriptor m_file;
+    std::string m_tmp_path; // 改名之后清空
+    bytes_buffer m_buf{64 * 1024};
+    size_t m_total = 0;
+
+    upload_state(http_server::http_request &request, file_descriptor file,
+                 std::string tmp_path)
+        : m_request(request), m_file(std::move(file)),
+          m_tmp_path(std::move(tmp_path)) {}
+
+    upload_state(upload_state &&) = delete;
+
+    ~upload_state() {
+        if (!m_tmp_path.empty()) {
+            unlink(m_tmp_path.c_str());
+        }
+    }
+
+    // 可能阻塞
+    expected<int> commit() {
+        m_file = file_descriptor();
+        if (rename(m_tmp_path.c_str(), (static_root + "/upload.bin").c_str()) == -1) {
+            return -errno;
+        }
+        m_tmp_path.clear();
+        return 0;
+    }
+};
+
+// 可能阻塞：在静态目录里独占地创建一个新的临时文件
+expected<int> open_upload_tmp(std::string &path) {
+    static std::atomic<unsigned> counter{0};
+    path = static_root + "/.upload.tmp" + std::to_string(++counter) + "." +
+           std::to_string(getpid());
+    return convert_error(
+        open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644));
+}
+
+void do_upload_read(std::shared_ptr<upload_state> state) {
+    auto &request = state->m_request;
+    request.read_body(state->m_buf, [state](expected<size_t> ret) {
+        if (ret.error()) {
+            return; // 连接已经关闭，state 随这个回调释放，临时文件随之删除
+        }
+        size_t n = ret.value();
+        if (n == 0) {
+            return worker_pool::blocking_io().async_run(
+                [state] {
+                    return state->commit();
+                },
+                [state](expected<int> ret) {
+                    if (ret.error()) {
+                        return state->m_request.write_response(500, "500 Internal Server Error");
+                    }
+                    state->m_request.write_response(200, std::to_string(state->m_total));
+                });
+        }
+        worker_pool::blocking_io().async_run(
+            [state, n] {
+                return _fd_write_all(state->m_file.m_fd, std::string_view{state->m_buf.data(), n});
+            },
+            [state](expected<size_t> ret) {
+                if (ret.error()) {
+                    return state->m_request.write_response(500, "500 Internal Server Error");
+                }
+                state->m_total += ret.value();
+                return do_upload_read(state);
+            });
     });
+}
+
+// 所有线程共用一个上传存储，位于 static/uploads
+upload_store &uploads() {
+    static upload_store store(static_root + "/uploads");
+    return store;
+}
+
+// 表单上传图片：multipart 正文边读边解析，第一个文件的内容边读边在阻塞 I/O
+// 线程池里写入上传存储（同时计算哈希），写完一块再读下一块
+// 多个上传各自写自己的临时文件，互不覆盖
+struct image_upload_state {
+    http_server::http_request &m_request;
+    multipart_parser m_parser;
+    upload_store::writer m_writer;
+    bytes_buffer m_buf{64 * 1024};
+    std::string m_pending; // 这一块里属于文件的内容，解析器给出的视图不能跨块保留
+    bool m_in_file = false;
+    bool m_have_file = false;
+
+    image_upload_state(http_server::http_request &request, std::string boundary)
+        : m_request(request), m_parser(std::move(boundary)) {
+        m_parser.on_part_begin = [this](multipart_part const &part) {
+            m_in_file = !m_have_file && !part.filename.empty();
+            m_have_file = m_have_file || m_in_file;
+        };
+        m_parser.on_part_data = [this](bytes_const_view data) {
+            if (m_in_file) {
+                m_pending.append(data.data(), data.size());
+            }
+        };
+        m_parser.on_part_end = [this] {
+            m_in_file = false;
+        };
+    }
+};
+
+// 上传完成：生成 PNG 编码（同样的图片只编码一次），再重定向到展示页面
+void do_image_commit(std::shared_ptr<image_upload_state> state) {
+    worker_pool::blocking_io().async_run(
+        [state] {
+            upload_store::entry_pointer entry;
+            if (auto ret = state->m_writer.commit(entry); ret.error()) {
+                entry = nullptr;
+            }
+            return entry;
+        },
+        [state](upload_store::entry_pointer entry) {
+            auto &request = state->m_request;
+            if (!entry) {
+                return request.write_response(500, "500 Internal Server Error");
+            }
+            image_pipeline::get().try_make_png(
+                uploads(), entry, [&request, id = entry->m_id](expected<int> ret) {
+                    if (ret.is_error(EBUSY)) {
+                        return request.write_response(503, "503 Service Unavailable");
+                    }
+                    if (ret.error()) {
+                        return request.write_response(400, "400 Bad Request");
+                    }
+                    request.write_redirect(303, "/1?id=" + id);
+                });
+        });
+}
 
-    server->get_router().route("/1", [](http_server::http_request &request) {
-        std::string response = file_get_content("showpic.html");
-        request.write_response(200, response, "text/html");
+void do_image_read(std::shared_ptr<image_upload_state> state) {
+    auto &request = state->m_request;
+    request.read_body(state->m_buf, [state](expected<size_t> ret) {
+        if (ret.error()) {
+            return; // 连接已经关闭，state 随这个回调释放，临时文件由 writer 删除
+        }
+        auto &request = state->m_request;
+        size_t n = ret.value();
+        if (n == 0) {
+            if (!state->m_parser.finished() || !state->m_have_file) {
+                return request.write_response(400, "400 Bad Request");
+            }
+            return do_image_commit(state);
+        }
+        state->m_pending.clear();
+        if (!state->m_parser.push_chunk({state->m_buf.data(), n})) {
+            return request.write_response(400, "400 Bad Request");
+        }
+        if (state->m_pending.empty()) {
+            return do_image_read(state);
+        }
+        worker_pool::blocking_io().async_run(
+            [state]() -> expected<size_t> {
+                auto &writer = state->m_writer;
+                if (!writer.is_open()) {
+                    if (auto ret = writer.open(uploads()); ret.error()) {
+                        return ret.error();
+                    }
+                }
+                return writer.write({state->m_pending.data(), state->m_pending.size()});
+            },
+            [state](expected<size_t> ret) {
+                if (ret.error()) {
+                    return state->m_request.write_response(500, "500 Internal Server Error");
+                }
+                return do_image_read(state);
+            });
     });
+}
+
+// 发送 PNG 编码：文件描述符属于存储中的条目，复制一个交给连接 sendfile
+void write_png_response(http_server::http_request &request, int fd) {
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (copy == -1) {
+        return request.write_response(500, "500 Internal Server Error");
+    }
+    request.write_file_response(file_descriptor(copy), "image/png");
+}
+
+void setup_routes(http_server::http_router &router) {
+    http_route_options image_options;
+    image_options.m_max_body_size = 64 * 1024 * 1024;
+    image_options.m_streaming = true;
+    http_route_options upload_options;
+    upload_options.m_max_body_size = 1024 * 1024 * 1024;
+    upload_options.m_streaming = true;
+
+    router.route("/", [](http_server::http_request &request) {
+        request.write_static_response("picture.html", "text/html");
+    });
+
+    // 表单上传的图片按内容保存到上传存储，展示页面用 /x.png?id=<id> 取得它的 PNG
+    router.route("/1", [](http_server::http_request &request) {
+        if (post_image_process::judgePostType(request.con_type) != POST_TYPE::image) {
+            return request.write_static_response("showpic.html", "text/html");
+        }
+        std::string boundary =
+            multipart_parser::boundary_from_content_type(request.con_type);
+        if (boundary.empty()) {
+            return request.write_response(400, "400 Bad Request");
+        }
+        do_image_read(std::make_shared<image_upload_state>(request, std::move(boundary)));
+    }, image_options);
+
+    router.route("/upload", [](http_server::http_request &request) {
+        std::string tmp_path;
+        auto fd = open_upload_tmp(tmp_path);
+        if (fd.error()) {
+            return request.write_response(500, "500 Internal Server Error");
+        }
+        do_upload_read(std::make_shared<upload_state>(
+            request, file_descriptor(fd.value()), std::move(tmp_path)));
+    }, upload_options);
 
-    server->get_router().route("/x.png", [](http_server::http_request &request) {
-        std::string response = file_get_content("test.png");
-        request.write_response(200, response, "image/png");
+    // 没有 id 时发送最近一次上传的图片
+    router.route("/x.png", [](http_server::http_request &request) {
+        std::string id(request.query("id"));
+        if (id.empty()) {
+            id = uploads().latest();
+        }
+        if (!upload_store::valid_id(id)) {
+            return request.write_response(404, "404 Not Found");
+        }
+        if (auto entry = uploads().find_cached(id)) {
+            if (auto fd = entry->variant_fd("png"); !fd.error()) {
+                return write_png_response(request, fd.value());
+            }
+        }
+        // 不在索引中（例如重启之前上传的）或者还没有 PNG 编码
+        worker_pool::blocking_io().async_run(
+            [id] {
+                return uploads().find(id);
+            },
+            [&request](upload_store::entry_pointer entry) {
+                if (!entry) {
+                    return request.write_response(404, "404 Not Found");
+                }
+                image_pipeline::get().try_make_png(
+                    uploads(), entry, [&request](expected<int> ret) {
+                        if (ret.is_error(EBUSY)) {
+                            return request.write_response(503, "503 Service Unavailable");
+                        }
+                        if (ret.error()) {
+                            return request.write_response(404, "404 Not Found");
+                        }
+                        write_png_response(request, ret.value());
+                    });
+            });
     });
+}
+
+void server() {
+    chdir("../static");
+    if (char *root = realpath(".", nullptr)) {
+        static_root = root;
+        std::free(root);
+    }
+    uploads(); // 在启动线程之前创建好上传存储
+
+    // 先屏蔽信号再创建线程，让所有工作线程都继承屏蔽字，
+    // 由主线程统一 sigwait 后通知线程池退出
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    http_server_pool pool;
     // fmt::println("正在监听：http://127.0.0.1:8080");
-    server->do_start("0.0.0.0", "8080");
+    pool.do_start("0.0.0.0", "8080", setup_routes);
 
-    ctx.join();
+    int sig;
+    sigwait(&sigs, &sig);
+    pool.stop();
+    pool.join();
+
+    auto stats = pool.connection_pool_stats();
+    std::printf("连接对象池：命中 %zu 次，未命中 %zu 次，命中率 %.1f%%\n",
+                stats.m_hits, stats.m_misses, stats.hit_rate() * 100);
 }
 
 int main() {
@@ -35,4 +315,4 @@ int main() {
     //                  e.code().value());
     // }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,53 +1,256 @@
 #pragma once
 
-#include <map>
+#include <array>
 #include <chrono>
+#include <cstdint>
 #include "callback.hpp"
 #include "stop_source.hpp"
 
+// 分层时间轮：4 层，每层 256 个槽位，最小刻度 1ms
+// 第 0 层覆盖 256ms，第 1 层 65s，第 2 层 4.6 小时，第 3 层 49 天
+// 插入、取消都是 O(1)：条目是侵入式链表节点，用完后放回空闲链表复用
 struct timer_context {
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::milliseconds _tick{1};
+    static constexpr unsigned _slot_bits = 8;
+    static constexpr size_t _slot_count = size_t(1) << _slot_bits;
+    static constexpr uint64_t _slot_mask = _slot_count - 1;
+    static constexpr size_t _level_count = 4;
+    // 粗粒度定时器对齐到第 1 层的槽位边界（256ms），只会在整层下放时触发
+    static constexpr uint64_t _coarse_ticks = _slot_count;
+
     struct _timer_entry {
+        _timer_entry *m_next = nullptr;
+        _timer_entry **m_pprev = nullptr; // 指向前一个节点的 m_next，O(1) 摘除
+        uint64_t m_expire = 0;            // 到期的刻度
         callback<> m_cb;
-        stop_source m_stop;
+        stop_callback m_stop_cb; // 挂在 stop_source 上，提前取消用
     };
 
-    std::multimap<std::chrono::steady_clock::time_point, _timer_entry>
-        m_timer_heap;
+    using _timer_list = _timer_entry *;
+
+    std::array<std::array<_timer_list, _slot_count>, _level_count> m_wheel{};
+    clock::time_point m_base = clock::now();
+    uint64_t m_current_tick = 0; // 已经处理完的刻度
+    size_t m_count = 0;
+    _timer_entry *m_free_list = nullptr;
+    clock::time_point m_now = m_base; // 每轮循环更新一次的当前时间
 
     timer_context() = default;
     timer_context(timer_context &&) = delete;
 
-    void set_timeout(std::chrono::steady_clock::duration dt, callback<> cb,
-                     stop_source stop = {}) {
-        auto expire_time = std::chrono::steady_clock::now() + dt;
-        auto it = m_timer_heap.insert(
-            {expire_time, _timer_entry{std::move(cb), stop}});
-        stop.set_stop_callback([this, it] {
-            auto cb = std::move(it->second.m_cb);
-            m_timer_heap.erase(it);
+    ~timer_context() {
+        for (auto &level: m_wheel) {
+            for (auto &slot: level) {
+                while (slot) {
+                    _timer_entry *entry = slot;
+                    _unlink(entry);
+                    delete entry;
+                }
+            }
+        }
+        while (m_free_list) {
+            _timer_entry *entry = m_free_list;
+            m_free_list = entry->m_next;
+            delete entry;
+        }
+    }
+
+    uint64_t _tick_of(clock::time_point tp) const noexcept {
+        if (tp <= m_base) {
+            return 0;
+        }
+        return static_cast<uint64_t>((tp - m_base) / _tick);
+    }
+
+    clock::time_point _time_of(uint64_t tick) const noexcept {
+        return m_base + tick * _tick;
+    }
+
+    static void _link(_timer_list &list, _timer_entry *entry) noexcept {
+        entry->m_next = list;
+        if (list) {
+            list->m_pprev = &entry->m_next;
+        }
+        entry->m_pprev = &list;
+        list = entry;
+    }
+
+    static void _unlink(_timer_entry *entry) noexcept {
+        *entry->m_pprev = entry->m_next;
+        if (entry->m_next) {
+            entry->m_next->m_pprev = entry->m_pprev;
+        }
+        entry->m_next = nullptr;
+        entry->m_pprev = nullptr;
+    }
+
+    _timer_entry *_alloc_entry() {
+        if (m_free_list) {
+            _timer_entry *entry = m_free_list;
+            m_free_list = entry->m_next;
+            entry->m_next = nullptr;
+            return entry;
+        }
+        return new _timer_entry;
+    }
+
+    void _free_entry(_timer_entry *entry) noexcept {
+        entry->m_stop_cb.reset();
+        entry->m_next = m_free_list;
+        m_free_list = entry;
+    }
+
+    // 根据离到期还有多远，决定放进哪一层的哪个槽位
+    void _place(_timer_entry *entry) noexcept {
+        uint64_t expire = entry->m_expire;
+        uint64_t delta = expire - m_current_tick;
+        size_t level = 0;
+        while (level + 1 < _level_count &&
+               delta >= (uint64_t(1) << (_slot_bits * (level + 1)))) {
+            ++level;
+        }
+        uint64_t max_delta = uint64_t(1) << (_slot_bits * _level_count);
+        if (delta >= max_delta) {
+            // 超出整个时间轮的范围，先挂在最高层最远的槽位，下放时再重新安排
+            expire = m_current_tick + max_delta - 1;
+        }
+        size_t index = (expire >> (_slot_bits * level)) & _slot_mask;
+        _link(m_wheel[level][index], entry);
+    }
+
+    void _add_timer(uint64_t expire, callback<> cb, stop_source stop) {
+        if (expire <= m_current_tick) {
+            expire = m_current_tick + 1; // 当前刻度已经处理过了，顺延一格
+        }
+        _timer_entry *entry = _alloc_entry();
+        entry->m_expire = expire;
+        entry->m_cb = std::move(cb);
+        _place(entry);
+        ++m_count;
+        stop.add_stop_callback(entry->m_stop_cb, [this, entry] {
+            // 提前取消时，立即调用定时器的回调
+            _unlink(entry);
+            --m_count;
+            auto cb = std::move(entry->m_cb);
+            _free_entry(entry);
             cb();
         });
     }
 
-    std::chrono::steady_clock::duration duration_to_next_timer() {
-        while (!m_timer_heap.empty()) {
-            auto it = m_timer_heap.begin();
-            // 看看最近的一次计时器事件，是否已经过时？
-            auto now = std::chrono::steady_clock::now();
-            if (it->first <= now) {
-                // 如果已经过时，则触发该定时器的回调，并删除
-                it->second.m_stop.clear_stop_callback();
-                auto cb = std::move(it->second.m_cb);
-                m_timer_heap.erase(it);
-                cb();
-            } else {
-                return it->first - now;
+    void set_timeout(clock::duration dt, callback<> cb, stop_source stop = {}) {
+        auto expire_time = clock::now() + dt;
+        // 向上取整，保证不会早于 dt 触发
+        uint64_t expire = _tick_of(expire_time - clock::duration(1)) + 1;
+        _add_timer(expire, std::move(cb), stop);
+    }
+
+    // 适合很少真正触发的长超时：到期时间向上对齐到 256ms，
+    // 大量这样的定时器共享槽位，不需要逐毫秒处理，也不会额外唤醒循环
+    void set_coarse_timeout(clock::duration dt, callback<> cb,
+                            stop_source stop = {}) {
+        uint64_t expire = _tick_of(clock::now() + dt) + _coarse_ticks;
+        expire &= ~(_coarse_ticks - 1);
+        _add_timer(expire, std::move(cb), stop);
+    }
+
+    // 把某一层的一个槽位整体下放到更低的层
+    void _cascade(size_t level, size_t index) noexcept {
+        _timer_list list = m_wheel[level][index];
+        m_wheel[level][index] = nullptr;
+        while (list) {
+            _timer_entry *entry = list;
+            list = entry->m_next;
+            entry->m_next = nullptr;
+            _place(entry);
+        }
+    }
+
+    void _process_tick(uint64_t tick) {
+        m_current_tick = tick;
+        for (size_t level = 1; level < _level_count; ++level) {
+            if ((tick & ((uint64_t(1) << (_slot_bits * level)) - 1)) != 0) {
+                break;
             }
+            _cascade(level, (tick >> (_slot_bits * level)) & _slot_mask);
+        }
+
+        // 把到期的槽位整体摘下来成为局部链表，回调里增删定时器不会互相干扰
+        _timer_list expired = m_wheel[0][tick & _slot_mask];
+        if (!expired) {
+            return;
+        }
+        m_wheel[0][tick & _slot_mask] = nullptr;
+        expired->m_pprev = &expired;
+        while (expired) {
+            _timer_entry *entry = expired;
+            _unlink(entry);
+            --m_count;
+            auto cb = std::move(entry->m_cb);
+            _free_entry(entry);
+            cb();
+        }
+    }
+
+    // 找出下一个非空槽位对应的刻度，用于决定 epoll 最多等多久
+    uint64_t _next_event_tick() const noexcept {
+        uint64_t best = static_cast<uint64_t>(-1);
+        for (size_t level = 0; level < _level_count; ++level) {
+            unsigned shift = _slot_bits * level;
+            uint64_t block = m_current_tick >> shift;
+            for (uint64_t k = 1; k <= _slot_count; ++k) {
+                if (m_wheel[level][(block + k) & _slot_mask]) {
+                    // 第 0 层是精确到期时间，更高层是需要下放的时刻
+                    uint64_t tick = (block + k) << shift;
+                    if (tick < best) {
+                        best = tick;
+                    }
+                    break;
+                }
+            }
+            unsigned next_shift = shift + _slot_bits;
+            if (best != static_cast<uint64_t>(-1) &&
+                best < (((m_current_tick >> next_shift) + 1) << next_shift)) {
+                break; // 更高层的事件不可能更早
+            }
+        }
+        return best;
+    }
+
+    // 不需要精确时间的场合（记录活动时间戳等）使用，省掉 clock::now()
+    clock::time_point coarse_now() const noexcept {
+        return m_now;
+    }
+
+    void _update_now() noexcept {
+        m_now = clock::now();
+    }
+
+    clock::duration duration_to_next_timer() {
+        auto now = clock::now();
+        m_now = now;
+        uint64_t now_tick = _tick_of(now);
+        if (m_count == 0) {
+            m_current_tick = now_tick;
+            return std::chrono::nanoseconds(-1);
+        }
+        // 批量处理从上次到现在之间所有的刻度
+        while (m_current_tick < now_tick && m_count != 0) {
+            _process_tick(m_current_tick + 1);
+        }
+        if (m_count == 0) {
+            m_current_tick = now_tick;
+            return std::chrono::nanoseconds(-1);
+        }
+        auto next = _time_of(_next_event_tick());
+        if (next <= now) {
+            return clock::duration::zero();
         }
-        return std::chrono::nanoseconds(-1);
+        return next - now;
     }
 
     bool is_empty() const {
-        return m_timer_heap.empty();
+        return m_count == 0;
     }
-};
\ No newline at end of file
+};
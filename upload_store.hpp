@@ -0,0 +1,289 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include "bytes_buffer.hpp"
+#include "callback.hpp"
+#include "expected.hpp"
+#include "file_utils.hpp"
+#include "sha256.hpp"
+
+// 按内容寻址的上传文件存储：文件以内容的 SHA-256（十六进制）命名，
+// 相同的内容只保存一份；由原文件生成的编码结果（如 PNG）保存为
+// "<id>.<扩展名>"，每种只生成一次
+// 内存索引把 id 映射到已经打开的文件，发送时直接 sendfile，不用再 open；
+// 索引只保留最近用过的 m_max_entries 个，淘汰的条目在最后一个使用者
+// 放下它时关闭文件，再用到时按哈希路径重新打开（路径由内容决定，打开很便宜）
+// 所有线程的 io_context 共用一个，索引由互斥锁保护；
+// 标明“可能阻塞”的函数应当在工作线程调用
+struct upload_store {
+    struct entry {
+        std::string m_id;
+        file_descriptor m_file;
+        size_t m_size = 0;
+        // 只在查找、更新下面两张表时短暂持有，读原文件、编码、写盘都不持有
+        std::mutex m_mutex;
+        std::map<std::string, file_descriptor> m_variants; // 扩展名 -> 文件
+        // 正在生成的编码 -> 等它生成完的回调，同一种编码不会被同时生成两次
+        std::map<std::string, std::vector<callback<expected<int>>>> m_encoding;
+
+        // 不阻塞，供循环线程走快速路径：已经生成的编码的文件描述符，
+        // 没有时返回 -ENOENT；锁正被别的线程持有时不等待，返回 -EAGAIN，
+        // 调用者照常走排队的路径
+        expected<int> variant_fd(std::string const &ext) {
+            std::unique_lock lock(m_mutex, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                return -EAGAIN;
+            }
+            auto it = m_variants.find(ext);
+            if (it == m_variants.end()) {
+                return -ENOENT;
+            }
+            return it->second.m_fd;
+        }
+
+        // 不阻塞：准备取得一种编码
+        // 已经生成过时返回文件描述符，waiter 不动；否则收下 waiter，
+        // 生成完后在生成者的线程上以生成的结果调用它：
+        // 别人正在生成时返回 -EINPROGRESS；没有人在生成时登记为正在生成，
+        // 返回 -ENOENT，调用者必须接着调用 make_variant
+        // （做不到时以错误调用 finish_variant，把等待者放走）
+        expected<int> begin_variant(std::string const &ext,
+                                    callback<expected<int>> &waiter) {
+            std::lock_guard lock(m_mutex);
+            if (auto it = m_variants.find(ext); it != m_variants.end()) {
+                return it->second.m_fd;
+            }
+            auto [it, inserted] = m_encoding.try_emplace(ext);
+            it->second.push_back(std::move(waiter));
+            return inserted ? -ENOENT : -EINPROGRESS;
+        }
+
+        // 生成结束：成功时 ret 是新打开的文件描述符，交给条目保管；
+        // 然后在当前线程依次调用等待者
+        void finish_variant(std::string const &ext, expected<int> ret) {
+            std::vector<callback<expected<int>>> waiters;
+            {
+                std::lock_guard lock(m_mutex);
+                if (!ret.error()) {
+                    m_variants.insert_or_assign(ext, file_descriptor(ret.value()));
+                }
+                if (auto it = m_encoding.find(ext); it != m_encoding.end()) {
+                    waiters = std::move(it->second);
+                    m_encoding.erase(it);
+                }
+            }
+            for (auto &waiter: waiters) {
+                waiter(ret);
+            }
+        }
+    };
+
+    using entry_pointer = std::shared_ptr<entry>;
+
+    using _lru_list = std::list<entry_pointer>;
+
+    std::string m_dir; // 以 '/' 结尾
+    std::mutex m_mutex;
+    _lru_list m_lru; // 最近用过的在前
+    std::unordered_map<std::string, _lru_list::iterator> m_index;
+    size_t m_max_entries;
+    std::string m_latest; // 最近一次上传的 id
+    std::atomic<unsigned> m_tmp_counter{0};
+
+    // 每个条目最多占用原文件加上各种编码的几个文件描述符
+    explicit upload_store(std::string dir, size_t max_entries = 256)
+        : m_dir(std::move(dir)), m_max_entries(max_entries) {
+        if (!m_dir.empty() && m_dir.back() != '/') {
+            m_dir.push_back('/');
+        }
+        if (mkdir(m_dir.c_str(), 0755) == -1 && errno != EEXIST) {
+            throw std::system_error(errno, std::generic_category(), m_dir);
+        }
+    }
+
+    upload_store(upload_store &&) = delete;
+
+    // id 来自客户端，只接受 64 个小写十六进制字符，不会拼出别的路径
+    static bool valid_id(std::string_view id) noexcept {
+        if (id.size() != 64) {
+            return false;
+        }
+        for (char c: id) {
+            if (!(('0' <= c && c <= '9') || ('a' <= c && c <= 'f'))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 不阻塞：只查内存索引
+    entry_pointer find_cached(std::string const &id) {
+        std::lock_guard lock(m_mutex);
+        auto it = m_index.find(id);
+        if (it == m_index.end()) {
+            return nullptr;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        return *it->second;
+    }
+
+    // 可能阻塞：不在索引中时从磁盘打开（例如服务器重启之前上传的）
+    entry_pointer find(std::string const &id) {
+        if (!valid_id(id)) {
+            return nullptr;
+        }
+        if (auto e = find_cached(id)) {
+            return e;
+        }
+        int fd = open((m_dir + id).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return nullptr;
+        }
+        return _insert(id, file_descriptor(fd));
+    }
+
+    std::string latest() {
+        std::lock_guard lock(m_mutex);
+        return m_latest;
+    }
+
+    entry_pointer _insert(std::string const &id, file_descriptor file) {
+        struct stat st;
+        if (fstat(file.m_fd, &st) == -1) {
+            return nullptr;
+        }
+        auto e = std::make_shared<entry>();
+        e->m_id = id;
+        e->m_file = std::move(file);
+        e->m_size = st.st_size;
+        std::lock_guard lock(m_mutex);
+        // 同样的内容可能被同时上传，以先放进索引的为准
+        auto [it, inserted] = m_index.try_emplace(id);
+        if (!inserted) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            return *it->second;
+        }
+        it->second = m_lru.insert(m_lru.begin(), std::move(e));
+        if (m_lru.size() > m_max_entries) {
+            // 正在使用的条目由使用者持有，发送完才关闭
+            m_index.erase(m_lru.back()->m_id);
+            m_lru.pop_back();
+        }
+        return *it->second;
+    }
+
+    // 流式写入一个上传文件（可能阻塞）：write 逐块写进临时文件，同时计算哈希，
+    // commit 时按哈希改名；同样的内容已经存在时丢弃这次的临时文件
+    struct writer {
+        upload_store *m_store = nullptr;
+        file_descriptor m_file;
+        std::string m_tmp_path;
+        sha256 m_hash;
+        size_t m_size = 0;
+
+        writer() = default;
+        writer(writer &&) = delete;
+
+        ~writer() {
+            if (!m_tmp_path.empty()) {
+                unlink(m_tmp_path.c_str());
+            }
+        }
+
+        expected<int> open(upload_store &store) {
+            m_store = &store;
+            m_tmp_path = store.m_dir + ".tmp" + std::to_string(++store.m_tmp_counter) +
+                         "." + std::to_string(getpid());
+            int fd = ::open(m_tmp_path.c_str(),
+                            O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (fd == -1) {
+                m_tmp_path.clear();
+                return -errno;
+            }
+            m_file = file_descriptor(fd);
+            return 0;
+        }
+
+        bool is_open() const noexcept {
+            return m_file.m_fd != -1;
+        }
+
+        expected<size_t> write(bytes_const_view data) {
+            m_hash.update(data.data(), data.size());
+            m_size += data.size();
+            return _fd_write_all(m_file.m_fd, {data.data(), data.size()});
+        }
+
+        expected<int> commit(entry_pointer &result) {
+            std::string id = m_hash.hex_digest();
+            std::string path = m_store->m_dir + id;
+            m_file = file_descriptor();
+            if (access(path.c_str(), F_OK) == 0) {
+                unlink(m_tmp_path.c_str()); // 内容已经存在，不再保存第二份
+            } else if (rename(m_tmp_path.c_str(), path.c_str()) == -1) {
+                return -errno;
+            }
+            m_tmp_path.clear();
+            result = m_store->find(id);
+            if (!result) {
+                return -errno;
+            }
+            std::lock_guard lock(m_store->m_mutex);
+            m_store->m_latest = id;
+            return 0;
+        }
+    };
+
+    // 可能阻塞：生成 e 的一种编码，只能在 begin_variant 返回 -ENOENT 之后调用
+    // 结果（文件描述符，和条目的生命周期相同）经 finish_variant 交给等待者
+    // 磁盘上已经有时直接打开，否则读出原文件交给
+    // encode(std::string const &original, std::string &output) -> expected<int>
+    // 生成后保存，encode 失败时返回它的错误
+    template <class Encode>
+    void make_variant(entry &e, std::string const &ext, Encode &&encode) {
+        e.finish_variant(ext, _make_variant_file(e, ext, encode));
+    }
+
+    template <class Encode>
+    expected<int> _make_variant_file(entry &e, std::string const &ext,
+                                     Encode &encode) {
+        std::string path = m_dir + e.m_id + "." + ext;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd != -1) {
+            return fd;
+        }
+        std::string original, output;
+        if (auto ret = _file_read_all(m_dir + e.m_id, original); ret.error()) {
+            return ret.error();
+        }
+        if (auto ret = encode(original, output); ret.error()) {
+            return ret.error();
+        }
+        std::string tmp_path = m_dir + ".tmp" + std::to_string(++m_tmp_counter) +
+                               "." + std::to_string(getpid());
+        if (auto ret = _file_write_all(tmp_path, output); ret.error()) {
+            unlink(tmp_path.c_str());
+            return ret.error();
+        }
+        if (rename(tmp_path.c_str(), path.c_str()) == -1) {
+            int err = errno;
+            unlink(tmp_path.c_str());
+            return -err;
+        }
+        return convert_error(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    }
+};
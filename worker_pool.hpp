@@ -0,0 +1,121 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "callback.hpp"
+#include "io_context.hpp"
+
+// 固定数量的工作线程，执行会阻塞的任务（磁盘读写等），不让它们卡住事件循环
+// 任务的结果通过 io_context::post 回到提交它的循环线程，回调照常在循环里执行
+struct worker_pool {
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<callback<>> m_queue;
+    size_t m_max_queued; // 排队（尚未开始执行）的任务上限，0 表示不限
+    bool m_stopping = false;
+    std::vector<std::thread> m_threads;
+
+    explicit worker_pool(size_t nthreads, size_t max_queued = 0)
+        : m_max_queued(max_queued) {
+        for (size_t i = 0; i < nthreads; ++i) {
+            m_threads.emplace_back(&worker_pool::_thread_main, this);
+        }
+    }
+
+    worker_pool(worker_pool &&) = delete;
+
+    // 已经提交的任务全部执行完才退出
+    ~worker_pool() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        for (auto &thread: m_threads) {
+            thread.join();
+        }
+    }
+
+    // 进程内共用的阻塞 I/O 线程池，第一次使用时创建
+    static worker_pool &blocking_io() {
+        static worker_pool instance(4);
+        return instance;
+    }
+
+    // 线程安全：task 在某个工作线程上执行
+    void submit(callback<> task) {
+        {
+            std::lock_guard lock(m_mutex);
+            m_queue.push_back(std::move(task));
+        }
+        m_cv.notify_one();
+    }
+
+    // 线程安全：排队的任务已经达到上限时不提交，返回 false
+    [[nodiscard]] bool try_submit(callback<> &task) {
+        {
+            std::lock_guard lock(m_mutex);
+            if (m_max_queued != 0 && m_queue.size() >= m_max_queued) {
+                return false;
+            }
+            m_queue.push_back(std::move(task));
+        }
+        m_cv.notify_one();
+        return true;
+    }
+
+    // 只能在循环线程调用：work() 在工作线程执行，返回值交给 done，
+    // done 在当前 io_context 上执行；完成之前 join() 不会退出（stop() 之后也是）
+    template <class Work, class Done>
+    void async_run(Work work, Done done) {
+        callback<> task = _make_task(std::move(work), std::move(done));
+        submit(std::move(task));
+    }
+
+    // 同 async_run，但队列已满时什么也不做，返回 false，由调用者决定如何拒绝
+    template <class Work, class Done>
+    [[nodiscard]] bool try_async_run(Work work, Done done) {
+        callback<> task = _make_task(std::move(work), std::move(done));
+        if (!try_submit(task)) {
+            io_context::get().work_finished();
+            return false;
+        }
+        return true;
+    }
+
+    template <class Work, class Done>
+    static callback<> _make_task(Work work, Done done) {
+        io_context &ctx = io_context::get();
+        ctx.work_started();
+        return [&ctx, work = std::move(work), done = std::move(done)]() mutable {
+            auto result = work();
+            ctx.post([&ctx, result = std::move(result),
+                      done = std::move(done)]() mutable {
+                ctx.work_finished();
+                done(std::move(result));
+            });
+        };
+    }
+
+    void _thread_main() {
+        while (true) {
+            callback<> task;
+            {
+                std::unique_lock lock(m_mutex);
+                m_cv.wait(lock, [&] {
+                    return m_stopping || !m_queue.empty();
+                });
+                if (m_queue.empty()) {
+                    return;
+                }
+                task = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            task();
+        }
+    }
+};